@@ -0,0 +1,143 @@
+// background texture decoding
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include "AsyncTextureLoader.h"
+
+#include <Core/Exceptions.h>
+#include <Resources/ResourceManager.h>
+#include <Utils/PropertyTree.h>
+#include <Logging/Logger.h>
+
+using OpenEngine::Resources::ResourceManager;
+
+AsyncTextureLoader::AsyncTextureLoader(TextureLoader& textureLoader,
+                                       unsigned int threads)
+    : textureLoader(textureLoader), inFlight(0), running(true) {
+    for (unsigned int i = 0; i < threads; i++) {
+        workers.push_back(new Worker(*this));
+        workers.back()->Start();
+    }
+}
+
+AsyncTextureLoader::~AsyncTextureLoader() {
+    Stop();
+}
+
+void AsyncTextureLoader::Stop() {
+    if (!running) return;
+    running = false;
+    // wake every worker, they see running is false and return
+    work.Post(workers.size());
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->Wait();
+        delete workers[i];
+    }
+    workers.clear();
+}
+
+ITexture2DPtr AsyncTextureLoader::Load(std::string file) {
+    std::map<std::string, ITexture2DPtr>::iterator itr = textures.find(file);
+    if (itr != textures.end()) {
+        if (itr->second->GetID() != 0)
+            loadedEvent.Notify(TextureLoadedEventArg(file, itr->second));
+        return itr->second;
+    }
+
+    ITexture2DPtr texture = ResourceManager<ITexture2D>::Create(file);
+    textures[file] = texture;
+    files[texture.get()] = file;
+    pendingLock.Lock();
+    pending.push_back(texture);
+    inFlight++;
+    pendingLock.Unlock();
+    work.Post();
+    return texture;
+}
+
+void AsyncTextureLoader::Prefetch(PropertyTreeNode* node) {
+    if (node == NULL || !node->HaveNode("textures"))
+        return;
+    PropertyTreeNode* list = node->GetNode("textures");
+    for (unsigned int i = 0; i < list->GetSize(); i++) {
+        std::string file = list->GetNodeIdx(i)->GetValue<std::string>("");
+        if (file != "")
+            Load(file);
+    }
+}
+
+unsigned int AsyncTextureLoader::GetPending() {
+    pendingLock.Lock();
+    unsigned int n = inFlight;
+    pendingLock.Unlock();
+    return n;
+}
+
+bool AsyncTextureLoader::Next(ITexture2DPtr& texture) {
+    pendingLock.Lock();
+    bool found = !pending.empty();
+    if (found) {
+        texture = pending.front();
+        pending.pop_front();
+    }
+    pendingLock.Unlock();
+    return found;
+}
+
+void AsyncTextureLoader::Done(ITexture2DPtr texture) {
+    decodedLock.Lock();
+    decoded.push_back(texture);
+    decodedLock.Unlock();
+}
+
+void AsyncTextureLoader::Worker::Run() {
+    for (;;) {
+        loader.work.Wait();
+        if (!loader.running)
+            return;
+        ITexture2DPtr texture;
+        if (!loader.Next(texture))
+            continue;
+        try {
+            texture->Load();
+        }
+        catch (OpenEngine::Core::Exception e) {
+            logger.warning << "AsyncTextureLoader: " << e.what() << logger.end;
+            loader.pendingLock.Lock();
+            loader.inFlight--;
+            loader.pendingLock.Unlock();
+            continue;
+        }
+        loader.Done(texture);
+    }
+}
+
+void AsyncTextureLoader::Handle(RenderingEventArg arg) {
+    // swap out the decoded list so the workers are not held up by the
+    // uploads
+    std::deque<ITexture2DPtr> ready;
+    decodedLock.Lock();
+    ready.swap(decoded);
+    decodedLock.Unlock();
+    if (ready.empty())
+        return;
+
+    for (unsigned int i = 0; i < ready.size(); i++)
+        textureLoader.Load(ready[i]);
+
+    pendingLock.Lock();
+    inFlight -= ready.size();
+    pendingLock.Unlock();
+
+    for (unsigned int i = 0; i < ready.size(); i++)
+        loadedEvent.Notify(TextureLoadedEventArg(files[ready[i].get()], ready[i]));
+}
+
+void AsyncTextureLoader::Handle(DeinitializeEventArg arg) {
+    Stop();
+}
@@ -0,0 +1,134 @@
+// background texture decoding
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_ASYNC_TEXTURE_LOADER_H_
+#define _OESIM_ASYNC_TEXTURE_LOADER_H_
+
+#include <Core/IListener.h>
+#include <Core/IEngine.h>
+#include <Core/Event.h>
+#include <Core/Thread.h>
+#include <Core/Mutex.h>
+#include <Renderers/IRenderer.h>
+#include <Renderers/TextureLoader.h>
+#include <Resources/ITexture2D.h>
+
+#include "Signal.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+
+namespace OpenEngine {
+    namespace Utils {
+        class PropertyTreeNode;
+    }
+}
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::IEvent;
+using OpenEngine::Core::Event;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Core::Thread;
+using OpenEngine::Core::Mutex;
+using OpenEngine::Renderers::RenderingEventArg;
+using OpenEngine::Renderers::TextureLoader;
+using OpenEngine::Resources::ITexture2D;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Utils::PropertyTreeNode;
+
+/**
+ * Sent when a texture has been decoded and uploaded.
+ */
+struct TextureLoadedEventArg {
+    std::string file;
+    ITexture2DPtr texture;
+    TextureLoadedEventArg(std::string file, ITexture2DPtr texture)
+        : file(file), texture(texture) {}
+};
+
+/**
+ * Decodes textures on a pool of background threads and hands the
+ * decoded images to the TextureLoader on the render thread.
+ *
+ * Load() returns the texture handle immediately, but the texture is
+ * being decoded by a worker until LoadedEvent() reports it uploaded.
+ * Hand it to emitters or renderers only from that event: anything
+ * that loads a texture with id 0 by itself would decode it a second
+ * time, concurrently with the worker. Attach the loader to the
+ * renderer PreProcessEvent so uploads happen in the GL context, and
+ * to the engine DeinitializeEvent to stop the workers.
+ *
+ * Load() and Prefetch() create the resources and must be called from
+ * the main thread, only the decoding runs on the workers.
+ */
+class AsyncTextureLoader : public IListener<RenderingEventArg>,
+                           public IListener<DeinitializeEventArg> {
+private:
+    class Worker : public Thread {
+    private:
+        AsyncTextureLoader& loader;
+    public:
+        Worker(AsyncTextureLoader& loader) : loader(loader) {}
+        void Run();
+    };
+
+    TextureLoader& textureLoader;
+    std::vector<Worker*> workers;
+    std::map<std::string, ITexture2DPtr> textures;
+
+    std::map<ITexture2D*, std::string> files;
+    Event<TextureLoadedEventArg> loadedEvent;
+
+    std::deque<ITexture2DPtr> pending;
+    Mutex pendingLock;
+    Signal work;
+    std::deque<ITexture2DPtr> decoded;
+    Mutex decodedLock;
+    unsigned int inFlight;
+    volatile bool running;
+
+    bool Next(ITexture2DPtr& texture);
+    void Done(ITexture2DPtr texture);
+
+public:
+    AsyncTextureLoader(TextureLoader& textureLoader, unsigned int threads = 2);
+    virtual ~AsyncTextureLoader();
+
+    /**
+     * Create a texture and queue it for decoding. Loading the same
+     * file twice returns the same texture, if it is already uploaded
+     * LoadedEvent() is sent again right away.
+     */
+    ITexture2DPtr Load(std::string file);
+
+    /**
+     * Queue the textures listed under the textures key of an emitter
+     * configuration.
+     */
+    void Prefetch(PropertyTreeNode* node);
+
+    /**
+     * Number of textures not yet uploaded.
+     */
+    unsigned int GetPending();
+
+    /**
+     * Stop and join the workers. Textures not yet decoded are dropped.
+     */
+    void Stop();
+
+    IEvent<TextureLoadedEventArg>& LoadedEvent() { return loadedEvent; }
+
+    void Handle(RenderingEventArg arg);
+    void Handle(DeinitializeEventArg arg);
+};
+
+#endif
@@ -0,0 +1,94 @@
+// pooled one-shot burst effects
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_BURST_POOL_H_
+#define _OESIM_BURST_POOL_H_
+
+#include "EmitterGroup.h"
+
+#include <vector>
+
+/**
+ * A fixed number of one-shot burst effects (sparks, puffs) sharing an
+ * emitter template.
+ *
+ * All instances and their particles are allocated up front in an
+ * EmitterGroup. Trigger() takes a free instance, places it and emits
+ * its particles on the next tick; when the last particle of the burst
+ * has died the instance returns to the pool by itself. Idle instances
+ * are not in the running list of the group and cost nothing per tick.
+ * Triggering never allocates or loads anything.
+ *
+ * Attach the pool, not the group, to ParticleSystem::ProcessEvent.
+ */
+template <class T, class Initializer, class Chain>
+class BurstPool : public IListener<ParticleEventArg> {
+private:
+    EmitterGroup<T, Initializer, Chain> group;
+    std::vector<unsigned int> free;
+    unsigned int particles;
+
+public:
+    /**
+     * @param instances number of bursts that can be alive at once
+     * @param particles particles emitted by each burst
+     */
+    BurstPool(Initializer& init, Chain& chain,
+              unsigned int instances, unsigned int particles)
+        : group(init, chain), particles(particles) {
+        group.Reserve(instances);
+        free.reserve(instances);
+        for (unsigned int i = 0; i < instances; i++)
+            free.push_back(group.AddEmitter(particles, Vector<3,float>(), 0.0));
+    }
+
+    /**
+     * Start a burst at a position.
+     *
+     * @param count particles to emit, 0 for the full burst size
+     * @return false if all instances are in use
+     */
+    bool Trigger(Vector<3,float> position, unsigned int count = 0) {
+        if (free.empty())
+            return false;
+        unsigned int id = free.back();
+        free.pop_back();
+        GroupEmitter& e = group.GetEmitter(id);
+        e.position = position;
+        e.burst = (count == 0 || count > particles) ? particles : count;
+        group.SetActive(id, true);
+        return true;
+    }
+
+    unsigned int GetFree() {
+        return free.size();
+    }
+
+    EmitterGroup<T, Initializer, Chain>& GetGroup() {
+        return group;
+    }
+
+    void Handle(ParticleEventArg e) {
+        group.Handle(e);
+
+        // return finished bursts, backwards since deactivating moves
+        // the last running emitter into the freed slot
+        const std::vector<unsigned int>& running = group.GetRunning();
+        for (int i = int(running.size()) - 1; i >= 0; i--) {
+            unsigned int id = running[i];
+            GroupEmitter& em = group.GetEmitter(id);
+            if (em.burst == 0 && em.count == 0) {
+                group.SetActive(id, false);
+                free.push_back(id);
+            }
+        }
+    }
+};
+
+#endif
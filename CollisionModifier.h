@@ -0,0 +1,448 @@
+// particle collision against static scene geometry
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_COLLISION_MODIFIER_H_
+#define _OESIM_COLLISION_MODIFIER_H_
+
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+
+/**
+ * What happens to a particle that hits a collider.
+ *
+ * Bouncing particles keep restitution times their normal velocity
+ * and lose friction times their tangential velocity. Killed particles
+ * get their life set to maxlife so the LifespanModifier removes them.
+ */
+struct CollisionResponse {
+    enum Type { BOUNCE, KILL };
+    Type type;
+    float restitution;
+    float friction;
+
+    CollisionResponse(Type type = BOUNCE,
+                      float restitution = 0.5,
+                      float friction = 0.1)
+        : type(type), restitution(restitution), friction(friction) {}
+};
+
+/**
+ * Height samples on a regular grid in the xz-plane.
+ * Sample (i,j) is at origin + (i*spacing, heights[j*width+i], j*spacing)
+ * and everything below the surface is solid.
+ */
+struct HeightField {
+    Vector<3,float> origin;
+    float spacing;
+    unsigned int width, depth;
+    std::vector<float> heights;
+
+    HeightField(Vector<3,float> origin, float spacing,
+                unsigned int width, unsigned int depth)
+        : origin(origin), spacing(spacing), width(width), depth(depth),
+          heights(width*depth, origin[1]) {
+        if (width < 2 || depth < 2)
+            throw Exception("HeightField needs at least 2x2 samples.");
+    }
+
+    float& At(unsigned int i, unsigned int j) {
+        return heights[j*width+i];
+    }
+
+    float At(unsigned int i, unsigned int j) const {
+        return heights[j*width+i];
+    }
+
+    /**
+     * Bilinear height and its x/z slope at a point.
+     * Returns false outside the field.
+     */
+    bool Sample(float x, float z, float& h, float& dhdx, float& dhdz) const {
+        float u = (x - origin[0]) / spacing;
+        float v = (z - origin[2]) / spacing;
+        if (u < 0.0 || v < 0.0 || u > width-1 || v > depth-1)
+            return false;
+        unsigned int i = std::min((unsigned int)u, width-2);
+        unsigned int j = std::min((unsigned int)v, depth-2);
+        float fu = u - i, fv = v - j;
+        float h00 = At(i,j),   h10 = At(i+1,j);
+        float h01 = At(i,j+1), h11 = At(i+1,j+1);
+        h = (h00*(1-fu) + h10*fu)*(1-fv) + (h01*(1-fu) + h11*fu)*fv;
+        dhdx = ((h10-h00)*(1-fv) + (h11-h01)*fv) / spacing;
+        dhdz = ((h01-h00)*(1-fu) + (h11-h10)*fu) / spacing;
+        return true;
+    }
+};
+
+/**
+ * Collision of particles against static planes, boxes and height
+ * fields.
+ *
+ * Boxes and height fields are bucketed in a uniform grid when Build()
+ * is called, so each particle only tests the shapes overlapping its
+ * own cell. Planes are unbounded and tested for every particle, so
+ * keep them few (ground and walls).
+ *
+ * The response works on the Verlet representation where velocity is
+ * position - previousPosition, so it must run after the
+ * VerletModifier in the same tick. Boxes and height fields are tested
+ * against the whole segment moved in the tick, so particles faster
+ * than a wall is thick still hit it. Particles are independent, so
+ * ProcessBatch() runs in parallel when built with OpenMP.
+ */
+template <class T>
+class CollisionModifier {
+private:
+    enum Shape { PLANE, BOX, HEIGHTFIELD };
+
+    struct Collider {
+        Shape shape;
+        CollisionResponse response;
+        // plane: a = normal, d = offset. box: a = min, b = max
+        Vector<3,float> a, b;
+        float d;
+        unsigned int field;
+    };
+
+    std::vector<Collider> colliders;
+    std::vector<HeightField> fields;
+    std::vector<unsigned int> planes;
+
+    // grid cells in compressed row form: the colliders of cell c are
+    // cellItems[cellStart[c] .. cellStart[c+1])
+    std::vector<unsigned int> cellStart;
+    std::vector<unsigned int> cellItems;
+    Vector<3,float> gridMin;
+    float cellSize, invCellSize;
+    unsigned int dims[3];
+    bool built;
+
+    static inline float Dot(const Vector<3,float>& a, const Vector<3,float>& b) {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
+
+    void Bounds(const Collider& c, Vector<3,float>& min, Vector<3,float>& max) {
+        if (c.shape == BOX) {
+            min = c.a;
+            max = c.b;
+            return;
+        }
+        const HeightField& f = fields[c.field];
+        float lo = *std::min_element(f.heights.begin(), f.heights.end());
+        float hi = *std::max_element(f.heights.begin(), f.heights.end());
+        // a slab below the lowest sample keeps particles that are
+        // already under the surface in the grid
+        min = Vector<3,float>(f.origin[0], lo - cellSize, f.origin[2]);
+        max = Vector<3,float>(f.origin[0] + (f.width-1)*f.spacing,
+                              hi,
+                              f.origin[2] + (f.depth-1)*f.spacing);
+    }
+
+    inline int Cell(float x, unsigned int axis) const {
+        return int(std::floor((x - gridMin[axis]) * invCellSize));
+    }
+
+    static inline bool Inside(const Collider& c, const Vector<3,float>& p) {
+        for (unsigned int i = 0; i < 3; i++)
+            if (p[i] <= c.a[i] || p[i] >= c.b[i]) return false;
+        return true;
+    }
+
+    inline bool Below(const HeightField& f, const Vector<3,float>& p,
+                      float& h, float& dx, float& dz) const {
+        return f.Sample(p[0], p[2], h, dx, dz) && p[1] < h;
+    }
+
+    /**
+     * Test the motion of a particle during the tick, the segment from
+     * p0 to p1, against one collider, so fast particles can not pass
+     * through thin boxes or ridges of a height field. On contact
+     * returns true with the contact point on the surface and the
+     * outward surface normal.
+     */
+    bool Contact(const Collider& c,
+                 const Vector<3,float>& p0, const Vector<3,float>& p1,
+                 Vector<3,float>& surface, Vector<3,float>& normal) const {
+        switch (c.shape) {
+        case PLANE: {
+            // a half space can not be passed through, test the end point
+            float dist = Dot(c.a, p1) - c.d;
+            if (dist >= 0.0) return false;
+            normal = c.a;
+            surface = p1 - c.a * dist;
+            return true;
+        }
+        case BOX: {
+            if (Inside(c, p0)) {
+                // started inside, push out through the nearest face
+                if (!Inside(c, p1)) return false;
+                unsigned int axis = 0;
+                float best = p1[0] - c.a[0], side = -1.0;
+                for (unsigned int i = 0; i < 3; i++) {
+                    if (p1[i] - c.a[i] < best) {
+                        best = p1[i] - c.a[i]; axis = i; side = -1.0;
+                    }
+                    if (c.b[i] - p1[i] < best) {
+                        best = c.b[i] - p1[i]; axis = i; side = 1.0;
+                    }
+                }
+                normal = Vector<3,float>();
+                normal[axis] = side;
+                surface = p1;
+                surface[axis] = side < 0.0 ? c.a[axis] : c.b[axis];
+                return true;
+            }
+            // slab test, the segment enters the box at tin
+            Vector<3,float> d = p1 - p0;
+            float tin = -1.0, tout = 1.0, side = -1.0;
+            unsigned int axis = 0;
+            for (unsigned int i = 0; i < 3; i++) {
+                if (d[i] == 0.0) {
+                    if (p0[i] <= c.a[i] || p0[i] >= c.b[i]) return false;
+                    continue;
+                }
+                float ta = (c.a[i] - p0[i]) / d[i];
+                float tb = (c.b[i] - p0[i]) / d[i];
+                float s = -1.0;
+                if (ta > tb) {
+                    std::swap(ta, tb);
+                    s = 1.0;
+                }
+                if (ta > tin) {
+                    tin = ta; axis = i; side = s;
+                }
+                tout = std::min(tout, tb);
+            }
+            if (tin < 0.0 || tin >= tout)
+                return false;
+            normal = Vector<3,float>();
+            normal[axis] = side;
+            surface = p0 + d * tin;
+            surface[axis] = side < 0.0 ? c.a[axis] : c.b[axis];
+            return true;
+        }
+        case HEIGHTFIELD: {
+            const HeightField& f = fields[c.field];
+            float h, dx, dz;
+            if (Below(f, p0, h, dx, dz)) {
+                // started below, push the end point up
+                if (!Below(f, p1, h, dx, dz)) return false;
+                surface = p1;
+            }
+            else {
+                // march the segment in half sample steps for the first
+                // point below the surface, then bisect the crossing
+                Vector<3,float> d = p1 - p0;
+                float len = std::sqrt(d[0]*d[0] + d[2]*d[2]);
+                unsigned int steps = std::min(64u, 1u + (unsigned int)(2.0 * len / f.spacing));
+                float lo = 0.0, hi = -1.0;
+                for (unsigned int s = 1; s <= steps; s++) {
+                    float t = float(s) / steps;
+                    if (Below(f, p0 + d * t, h, dx, dz)) {
+                        hi = t;
+                        break;
+                    }
+                    lo = t;
+                }
+                if (hi < 0.0) return false;
+                for (unsigned int k = 0; k < 8; k++) {
+                    float t = 0.5 * (lo + hi);
+                    if (Below(f, p0 + d * t, h, dx, dz)) hi = t;
+                    else lo = t;
+                }
+                surface = p0 + d * hi;
+                f.Sample(surface[0], surface[2], h, dx, dz);
+            }
+            normal = Vector<3,float>(-dx, 1.0, -dz);
+            normal = normal * (1.0 / std::sqrt(dx*dx + 1.0 + dz*dz));
+            surface[1] = h;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    /**
+     * start is where the particle was at the beginning of the tick.
+     * It is kept over all colliders, since the previousPosition of a
+     * bounced particle is behind the surface it hit.
+     */
+    inline bool Respond(const Collider& c, const Vector<3,float>& start,
+                        T& particle) const {
+        Vector<3,float> surface, normal;
+        if (!Contact(c, start, particle.position, surface, normal))
+            return true;
+        if (c.response.type == CollisionResponse::KILL) {
+            particle.life = particle.maxlife;
+            return false;
+        }
+        Vector<3,float> v = particle.position - particle.previousPosition;
+        float vn = Dot(v, normal);
+        if (vn < 0.0) {
+            Vector<3,float> normalv = normal * vn;
+            Vector<3,float> tangentv = v - normalv;
+            v = tangentv * (1.0 - c.response.friction)
+                - normalv * c.response.restitution;
+        }
+        particle.position = surface;
+        particle.previousPosition = surface - v;
+        return true;
+    }
+
+public:
+    CollisionModifier(float cellSize = 10.0)
+        : cellSize(cellSize), invCellSize(1.0/cellSize), built(false) {
+        dims[0] = dims[1] = dims[2] = 0;
+    }
+
+    /**
+     * Add the half space below the plane normal . x = offset.
+     */
+    void AddPlane(Vector<3,float> normal, float offset,
+                  CollisionResponse response = CollisionResponse()) {
+        float len = std::sqrt(Dot(normal, normal));
+        Collider c;
+        c.shape = PLANE;
+        c.response = response;
+        c.a = normal * (1.0 / len);
+        c.d = offset / len;
+        planes.push_back(colliders.size());
+        colliders.push_back(c);
+    }
+
+    /**
+     * Add an axis aligned solid box.
+     */
+    void AddBox(Vector<3,float> min, Vector<3,float> max,
+                CollisionResponse response = CollisionResponse()) {
+        Collider c;
+        c.shape = BOX;
+        c.response = response;
+        c.a = min;
+        c.b = max;
+        colliders.push_back(c);
+        built = false;
+    }
+
+    void AddHeightField(const HeightField& field,
+                        CollisionResponse response = CollisionResponse()) {
+        Collider c;
+        c.shape = HEIGHTFIELD;
+        c.response = response;
+        c.field = fields.size();
+        fields.push_back(field);
+        colliders.push_back(c);
+        built = false;
+    }
+
+    /**
+     * Bucket boxes and height fields into the uniform grid. Must be
+     * called after the last collider is added and before processing.
+     */
+    void Build() {
+        static const unsigned int maxDim = 256;
+        Vector<3,float> min, max;
+        bool first = true;
+        for (unsigned int i = 0; i < colliders.size(); i++) {
+            if (colliders[i].shape == PLANE) continue;
+            Vector<3,float> lo, hi;
+            Bounds(colliders[i], lo, hi);
+            for (unsigned int k = 0; k < 3; k++) {
+                min[k] = first ? lo[k] : std::min(min[k], lo[k]);
+                max[k] = first ? hi[k] : std::max(max[k], hi[k]);
+            }
+            first = false;
+        }
+        gridMin = min;
+        // grow the cells if the scene is too large for the grid
+        for (unsigned int k = 0; k < 3; k++)
+            cellSize = std::max(cellSize, (max[k] - min[k]) / maxDim);
+        invCellSize = 1.0 / cellSize;
+        unsigned int cells = 1;
+        for (unsigned int k = 0; k < 3; k++) {
+            dims[k] = first ? 0 : Cell(max[k], k) + 1;
+            cells *= dims[k];
+        }
+
+        // count, prefix sum, fill
+        cellStart.assign(cells + 1, 0);
+        for (unsigned int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                for (unsigned int c = 0; c < cells; c++)
+                    cellStart[c+1] += cellStart[c];
+                cellItems.resize(cellStart[cells]);
+            }
+            std::vector<unsigned int> fill(cellStart.begin(), cellStart.end() - 1);
+            for (unsigned int i = 0; i < colliders.size(); i++) {
+                if (colliders[i].shape == PLANE) continue;
+                Vector<3,float> lo, hi;
+                Bounds(colliders[i], lo, hi);
+                for (int z = Cell(lo[2],2); z <= Cell(hi[2],2); z++)
+                    for (int y = Cell(lo[1],1); y <= Cell(hi[1],1); y++)
+                        for (int x = Cell(lo[0],0); x <= Cell(hi[0],0); x++) {
+                            unsigned int c = (z*dims[1] + y)*dims[0] + x;
+                            if (pass == 0) cellStart[c+1]++;
+                            else cellItems[fill[c]++] = i;
+                        }
+            }
+        }
+        built = true;
+    }
+
+    /**
+     * Collide a single particle.
+     * Returns false if the particle was killed.
+     */
+    inline bool Process(T& particle) {
+        const Vector<3,float> start = particle.previousPosition;
+        for (unsigned int i = 0; i < planes.size(); i++)
+            if (!Respond(colliders[planes[i]], start, particle)) return false;
+        if (!built || cellItems.empty()) return true;
+
+        // all cells touched by the motion of the tick. A collider in
+        // several of them is tested more than once, which is harmless
+        // as the segment from start to a resolved position no longer
+        // penetrates it.
+        int lo[3], hi[3];
+        for (unsigned int k = 0; k < 3; k++) {
+            float a = start[k], b = particle.position[k];
+            lo[k] = std::max(Cell(std::min(a, b), k), 0);
+            hi[k] = std::min(Cell(std::max(a, b), k), int(dims[k]) - 1);
+            if (lo[k] > hi[k]) return true;
+        }
+        for (int z = lo[2]; z <= hi[2]; z++)
+            for (int y = lo[1]; y <= hi[1]; y++)
+                for (int x = lo[0]; x <= hi[0]; x++) {
+                    unsigned int c = (z*dims[1] + y)*dims[0] + x;
+                    for (unsigned int i = cellStart[c]; i < cellStart[c+1]; i++)
+                        if (!Respond(colliders[cellItems[i]], start, particle)) return false;
+                }
+        return true;
+    }
+
+    /**
+     * Collide a contiguous array of particles. The grid is read only
+     * while processing, so the loop is split over the available cores.
+     */
+    void ProcessBatch(T* particles, unsigned int count) {
+        const int n = count;
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            Process(particles[i]);
+    }
+};
+
+#endif
@@ -0,0 +1,351 @@
+// emission shapes for particle emitters
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_EMISSION_SHAPES_H_
+#define _OESIM_EMISSION_SHAPES_H_
+
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+#include <Math/Math.h>
+#include <Math/RandomGenerator.h>
+
+#include <Resources/ResourceManager.h>
+#include <Resources/IModelResource.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/MeshNode.h>
+#include <Geometry/Mesh.h>
+#include <Geometry/GeometrySet.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+using OpenEngine::Math::RandomGenerator;
+
+/**
+ * Emission shape interface.
+ *
+ * Sample fills count positions and unit directions in one call, so an
+ * emitter pays one virtual call per tick instead of doing the shape
+ * maths inline per particle. Either array may be NULL if the emitter
+ * only needs the other.
+ */
+class IEmissionShape {
+public:
+    virtual ~IEmissionShape() {}
+    virtual void Sample(RandomGenerator& random, unsigned int count,
+                        Vector<3,float>* positions,
+                        Vector<3,float>* directions) = 0;
+
+protected:
+    static inline Vector<3,float> Cross(const Vector<3,float>& a,
+                                        const Vector<3,float>& b) {
+        return Vector<3,float>(a[1]*b[2] - a[2]*b[1],
+                               a[2]*b[0] - a[0]*b[2],
+                               a[0]*b[1] - a[1]*b[0]);
+    }
+
+    static inline Vector<3,float> Unit(const Vector<3,float>& v) {
+        float len = std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        return len > 0.0 ? v * (1.0 / len) : Vector<3,float>(0.0, 1.0, 0.0);
+    }
+
+    /**
+     * Two unit vectors orthogonal to the unit vector n and each other.
+     */
+    static void Basis(const Vector<3,float>& n,
+                      Vector<3,float>& u, Vector<3,float>& v) {
+        Vector<3,float> a = std::fabs(n[0]) < 0.9
+            ? Vector<3,float>(1.0, 0.0, 0.0) : Vector<3,float>(0.0, 1.0, 0.0);
+        u = Unit(Cross(n, a));
+        v = Cross(n, u);
+    }
+
+    static inline Vector<3,float> RandomDirection(RandomGenerator& random) {
+        float z = random.UniformFloat(-1.0, 1.0);
+        float phi = random.UniformFloat(0.0, 2*OpenEngine::Math::PI);
+        float r = std::sqrt(1.0 - z*z);
+        return Vector<3,float>(r*std::cos(phi), r*std::sin(phi), z);
+    }
+};
+
+/**
+ * All particles start at one point, in uniformly random directions.
+ */
+class PointShape : public IEmissionShape {
+private:
+    Vector<3,float> position;
+public:
+    PointShape(Vector<3,float> position) : position(position) {}
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (positions) positions[i] = position;
+            if (directions) directions[i] = RandomDirection(random);
+        }
+    }
+};
+
+/**
+ * Uniform in the parallelepiped center + a*s + b*t + c*u for s,t,u in
+ * [-1,1]. A zero axis gives a rectangle. Directions are fixed.
+ */
+class BoxShape : public IEmissionShape {
+private:
+    Vector<3,float> center, a, b, c, direction;
+public:
+    BoxShape(Vector<3,float> center,
+             Vector<3,float> a, Vector<3,float> b, Vector<3,float> c,
+             Vector<3,float> direction = Vector<3,float>(0.0, 1.0, 0.0))
+        : center(center), a(a), b(b), c(c), direction(Unit(direction)) {}
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (positions)
+                positions[i] = center
+                    + a * random.UniformFloat(-1.0, 1.0)
+                    + b * random.UniformFloat(-1.0, 1.0)
+                    + c * random.UniformFloat(-1.0, 1.0);
+            if (directions) directions[i] = direction;
+        }
+    }
+};
+
+/**
+ * Uniform on a disc, emitting along its normal.
+ */
+class DiscShape : public IEmissionShape {
+private:
+    Vector<3,float> center, normal, u, v;
+    float radius;
+public:
+    DiscShape(Vector<3,float> center, Vector<3,float> normal, float radius)
+        : center(center), normal(Unit(normal)), radius(radius) {
+        Basis(this->normal, u, v);
+    }
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (positions) {
+                // sqrt for uniform density over the area
+                float r = radius * std::sqrt(random.UniformFloat(0.0, 1.0));
+                float phi = random.UniformFloat(0.0, 2*OpenEngine::Math::PI);
+                positions[i] = center + u*(r*std::cos(phi)) + v*(r*std::sin(phi));
+            }
+            if (directions) directions[i] = normal;
+        }
+    }
+};
+
+/**
+ * Uniform in a spherical shell between innerRadius and radius,
+ * emitting radially outwards. innerRadius == radius gives the sphere
+ * surface, innerRadius == 0 the solid ball.
+ */
+class SphereShape : public IEmissionShape {
+private:
+    Vector<3,float> center;
+    float inner3, outer3;
+public:
+    SphereShape(Vector<3,float> center, float radius, float innerRadius = 0.0)
+        : center(center),
+          inner3(innerRadius*innerRadius*innerRadius),
+          outer3(radius*radius*radius) {}
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        for (unsigned int i = 0; i < count; i++) {
+            Vector<3,float> d = RandomDirection(random);
+            // cube root for uniform density over the volume
+            float r = std::pow(random.UniformFloat(inner3, outer3), 1.0f/3.0f);
+            if (positions) positions[i] = center + d * r;
+            if (directions) directions[i] = d;
+        }
+    }
+};
+
+/**
+ * Directions uniform over the solid angle within angle radians of the
+ * axis, all starting at the apex.
+ */
+class ConeShape : public IEmissionShape {
+private:
+    Vector<3,float> apex, axis, u, v;
+    float cosAngle;
+public:
+    ConeShape(Vector<3,float> apex, Vector<3,float> axis, float angle)
+        : apex(apex), axis(Unit(axis)), cosAngle(std::cos(angle)) {
+        Basis(this->axis, u, v);
+    }
+
+    void SetAngle(float angle) {
+        cosAngle = std::cos(angle);
+    }
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        for (unsigned int i = 0; i < count; i++) {
+            if (positions) positions[i] = apex;
+            if (directions) {
+                float z = random.UniformFloat(cosAngle, 1.0);
+                float phi = random.UniformFloat(0.0, 2*OpenEngine::Math::PI);
+                float r = std::sqrt(1.0 - z*z);
+                directions[i] = axis*z + u*(r*std::cos(phi)) + v*(r*std::sin(phi));
+            }
+        }
+    }
+};
+
+/**
+ * Uniform on the surface of a triangle mesh, emitting along the face
+ * normals.
+ *
+ * Triangles are chosen with probability proportional to their area
+ * through an alias table built once in the constructor, so each
+ * sample is O(1) regardless of the number of triangles.
+ */
+class MeshSurfaceShape : public IEmissionShape {
+private:
+    std::vector<Vector<3,float> > vertices;
+    std::vector<Vector<3,float> > normals;
+    std::vector<float> probability;
+    std::vector<unsigned int> alias;
+
+    void BuildAliasTable(const std::vector<float>& areas) {
+        const unsigned int n = areas.size();
+        float total = 0.0;
+        for (unsigned int i = 0; i < n; i++)
+            total += areas[i];
+        if (total <= 0.0)
+            throw Exception("MeshSurfaceShape: mesh has no area.");
+
+        // Vose's method: pair each under-full bucket with an over-full one
+        probability.resize(n);
+        alias.resize(n);
+        std::vector<float> scaled(n);
+        std::vector<unsigned int> small, large;
+        for (unsigned int i = 0; i < n; i++) {
+            scaled[i] = areas[i] * n / total;
+            if (scaled[i] < 1.0) small.push_back(i);
+            else large.push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            unsigned int s = small.back(); small.pop_back();
+            unsigned int l = large.back(); large.pop_back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) small.push_back(l);
+            else large.push_back(l);
+        }
+        // left overs are full up to rounding
+        for (unsigned int i = 0; i < large.size(); i++) {
+            probability[large[i]] = 1.0;
+            alias[large[i]] = large[i];
+        }
+        for (unsigned int i = 0; i < small.size(); i++) {
+            probability[small[i]] = 1.0;
+            alias[small[i]] = small[i];
+        }
+    }
+
+public:
+    /**
+     * @param triangles three vertices per triangle
+     */
+    MeshSurfaceShape(const std::vector<Vector<3,float> >& triangles)
+        : vertices(triangles) {
+        if (triangles.size() < 3 || triangles.size() % 3 != 0)
+            throw Exception("MeshSurfaceShape: expected a triangle list.");
+        const unsigned int n = triangles.size() / 3;
+        std::vector<float> areas(n);
+        normals.resize(n);
+        for (unsigned int t = 0; t < n; t++) {
+            Vector<3,float> c = Cross(triangles[3*t+1] - triangles[3*t],
+                                      triangles[3*t+2] - triangles[3*t]);
+            areas[t] = 0.5 * std::sqrt(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+            normals[t] = Unit(c);
+        }
+        BuildAliasTable(areas);
+    }
+
+    void Sample(RandomGenerator& random, unsigned int count,
+                Vector<3,float>* positions, Vector<3,float>* directions) {
+        const unsigned int n = probability.size();
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int t = std::min(unsigned(random.UniformFloat(0.0, 1.0) * n), n-1);
+            if (random.UniformFloat(0.0, 1.0) >= probability[t])
+                t = alias[t];
+            if (positions) {
+                // uniform barycentric coordinates
+                float r1 = std::sqrt(random.UniformFloat(0.0, 1.0));
+                float r2 = random.UniformFloat(0.0, 1.0);
+                positions[i] = vertices[3*t] * (1.0 - r1)
+                    + vertices[3*t+1] * (r1 * (1.0 - r2))
+                    + vertices[3*t+2] * (r1 * r2);
+            }
+            if (directions) directions[i] = normals[t];
+        }
+    }
+};
+
+/**
+ * Collects the triangles of all meshes in a scene graph, in the
+ * coordinates of the mesh nodes.
+ */
+class TriangleCollector : public OpenEngine::Scene::ISceneNodeVisitor {
+public:
+    std::vector<Vector<3,float> > triangles;
+
+    void VisitMeshNode(OpenEngine::Scene::MeshNode* node) {
+        using namespace OpenEngine::Geometry;
+        using namespace OpenEngine::Resources;
+        MeshPtr mesh = node->GetMesh();
+        if (mesh->GetType() == TRIANGLES) {
+            IDataBlockPtr verts = mesh->GetGeometrySet()->GetVertices();
+            IndicesPtr indices = mesh->GetIndices();
+            unsigned int* index = indices->GetData();
+            unsigned int begin = mesh->GetIndexOffset();
+            unsigned int end = begin + mesh->GetDrawingRange();
+            for (unsigned int i = begin; i + 2 < end; i += 3)
+                for (unsigned int k = 0; k < 3; k++) {
+                    Vector<3,float> v;
+                    verts->GetElement(index[i+k], v);
+                    triangles.push_back(v);
+                }
+        }
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * Emission shape from the surface of a model loaded through the
+ * registered model plugins (the OBJ plugin for .obj files).
+ */
+inline MeshSurfaceShape* CreateMeshSurfaceShape(std::string file) {
+    using namespace OpenEngine::Resources;
+    IModelResourcePtr model = ResourceManager<IModelResource>::Create(file);
+    model->Load();
+    OpenEngine::Scene::ISceneNode* root = model->GetSceneNode();
+    if (root == NULL)
+        throw Exception("MeshSurfaceShape: could not load " + file);
+    TriangleCollector collector;
+    root->Accept(collector);
+    model->Unload();
+    return new MeshSurfaceShape(collector.triangles);
+}
+
+#endif
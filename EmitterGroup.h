@@ -0,0 +1,215 @@
+// batched update of many small emitters
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_EMITTER_GROUP_H_
+#define _OESIM_EMITTER_GROUP_H_
+
+#include <ParticleSystem/ParticleSystem.h>
+#include <Core/IListener.h>
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+
+#include <vector>
+#include <algorithm>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+using OpenEngine::ParticleSystem::ParticleEventArg;
+
+/**
+ * A single emitter inside an EmitterGroup.
+ *
+ * The live particles of the emitter are packed in the group storage
+ * at [offset, offset + count).
+ */
+struct GroupEmitter {
+    Vector<3,float> position;
+    float emitRate;          // particles per unit of ParticleEventArg::dt
+    float accumulator;       // fractional particles carried to next tick
+    unsigned int burst;      // particles to emit at once on the next tick
+    unsigned int offset;
+    unsigned int capacity;
+    unsigned int count;
+    unsigned int slot;       // index in the running list when updating
+    bool active;             // emitting new particles
+    bool updating;           // in the running list, active or has live particles
+};
+
+/**
+ * Emitters that share particle type and modifier chain.
+ *
+ * Instead of attaching every emitter to ParticleSystem::ProcessEvent
+ * (one virtual Handle and one small collection per emitter) the group
+ * is attached once and updates all of its emitters in one pass over a
+ * single contiguous particle array. Only emitters that are active or
+ * still have live particles are kept in the running list, so idle
+ * emitters cost nothing per tick.
+ *
+ * The initializer must provide
+ *   void Process(T& particle, const GroupEmitter& emitter);
+ * and the modifier chain must provide
+ *   void Update(float dt);
+ *   bool Process(float dt, T& particle);
+ * Update is called once per tick before any particle is processed,
+ * Process returns false when the particle has died. A Fused pipeline
+ * is such a chain.
+ *
+ * EmitterGroupNode draws the particles of a group.
+ */
+template <class T, class Initializer, class Chain>
+class EmitterGroup : public IListener<ParticleEventArg> {
+private:
+    std::vector<T> particles;
+    std::vector<GroupEmitter> emitters;
+    std::vector<unsigned int> running;
+
+    Initializer& init;
+    Chain& chain;
+
+    inline T* Storage(const GroupEmitter& emitter) {
+        // &particles[offset] is out of range for an empty emitter at the end
+        if (particles.empty()) return NULL;
+        return &particles[0] + emitter.offset;
+    }
+
+    inline void Emit(GroupEmitter& emitter, float dt) {
+        emitter.accumulator += emitter.emitRate * dt;
+        unsigned int emits = (unsigned int)emitter.accumulator;
+        emitter.accumulator -= emits;
+        emits = std::min(emits + emitter.burst, emitter.capacity - emitter.count);
+        emitter.burst = 0;
+
+        T* p = Storage(emitter);
+        for (unsigned int i = 0; i < emits; i++)
+            init.Process(p[emitter.count++], emitter);
+    }
+
+    inline void Retire(GroupEmitter& emitter) {
+        unsigned int last = running.back();
+        running[emitter.slot] = last;
+        emitters[last].slot = emitter.slot;
+        running.pop_back();
+        emitter.updating = false;
+    }
+
+    inline void Update(GroupEmitter& emitter, float dt) {
+        T* p = Storage(emitter);
+        unsigned int i = 0;
+        while (i < emitter.count) {
+            if (chain.Process(dt, p[i]))
+                i++;
+            else
+                // move the last live particle into the hole, it is
+                // processed on the next iteration
+                p[i] = p[--emitter.count];
+        }
+    }
+
+public:
+    EmitterGroup(Initializer& init, Chain& chain)
+        : init(init), chain(chain) {}
+
+    virtual ~EmitterGroup() {}
+
+    /**
+     * Add an emitter with room for capacity particles.
+     * Emitters are created inactive.
+     *
+     * @return id of the new emitter
+     */
+    unsigned int AddEmitter(unsigned int capacity,
+                            Vector<3,float> position,
+                            float emitRate) {
+        GroupEmitter e;
+        e.position = position;
+        e.emitRate = emitRate;
+        e.accumulator = 0.0;
+        e.burst = 0;
+        e.offset = particles.size();
+        e.capacity = capacity;
+        e.count = 0;
+        e.slot = 0;
+        e.active = false;
+        e.updating = false;
+        particles.resize(particles.size() + capacity);
+        emitters.push_back(e);
+        return emitters.size() - 1;
+    }
+
+    /**
+     * Start or stop emission. A deactivated emitter keeps updating
+     * until its last particle has died.
+     */
+    void SetActive(unsigned int id, bool active) {
+        if (id >= emitters.size())
+            throw Exception("EmitterGroup: invalid emitter id.");
+        GroupEmitter& e = emitters[id];
+        e.active = active;
+        if (active && !e.updating) {
+            e.updating = true;
+            e.slot = running.size();
+            running.push_back(id);
+        }
+        else if (!active && e.updating && e.count == 0)
+            Retire(e);
+    }
+
+    /**
+     * Reserve room for a number of emitters running at once, so
+     * activating them does not allocate.
+     */
+    void Reserve(unsigned int emitters) {
+        running.reserve(emitters);
+    }
+
+    bool IsActive(unsigned int id) {
+        return emitters[id].active;
+    }
+
+    GroupEmitter& GetEmitter(unsigned int id) {
+        return emitters[id];
+    }
+
+    unsigned int GetNumEmitters() {
+        return emitters.size();
+    }
+
+    /**
+     * Live particles of an emitter are
+     * GetParticles(id)[0 .. GetEmitter(id).count).
+     */
+    T* GetParticles(unsigned int id) {
+        return Storage(emitters[id]);
+    }
+
+    const std::vector<unsigned int>& GetRunning() {
+        return running;
+    }
+
+    void Handle(ParticleEventArg e) {
+        chain.Update(e.dt);
+        const unsigned int n = running.size();
+        for (unsigned int i = 0; i < n; i++)
+            if (emitters[running[i]].active)
+                Emit(emitters[running[i]], e.dt);
+        for (unsigned int i = 0; i < n; i++)
+            Update(emitters[running[i]], e.dt);
+
+        // drop stopped emitters whose particles have all died,
+        // backwards since retiring moves the last one into the slot
+        for (int i = int(n) - 1; i >= 0; i--) {
+            GroupEmitter& em = emitters[running[i]];
+            if (!em.active && em.count == 0)
+                Retire(em);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+// render node drawing the particles of an emitter group
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_EMITTER_GROUP_NODE_H_
+#define _OESIM_EMITTER_GROUP_NODE_H_
+
+#include <Renderers/IRenderNode.h>
+#include <Renderers/IRenderingView.h>
+#include <Renderers/TextureLoader.h>
+#include <Resources/ITexture2D.h>
+#include <Meta/OpenGL.h>
+
+#include "EmitterGroup.h"
+
+using OpenEngine::Renderers::IRenderNode;
+using OpenEngine::Renderers::IRenderingView;
+using OpenEngine::Renderers::TextureLoader;
+using OpenEngine::Resources::ITexture2DPtr;
+
+/**
+ * Draws every running emitter of an EmitterGroup as camera facing
+ * quads in one batch, with one texture shared by the whole group.
+ *
+ * The particle type needs position, size and color.
+ */
+template <class T, class Initializer, class Chain>
+class EmitterGroupNode : public IRenderNode {
+private:
+    EmitterGroup<T, Initializer, Chain>& group;
+    TextureLoader& textureLoader;
+    ITexture2DPtr texture;
+
+public:
+    EmitterGroupNode(EmitterGroup<T, Initializer, Chain>& group,
+                     TextureLoader& textureLoader,
+                     ITexture2DPtr texture)
+        : group(group), textureLoader(textureLoader), texture(texture) {}
+
+    void Apply(IRenderingView* view) {
+        glPushAttrib(GL_LIGHTING);
+        glDisable(GL_LIGHTING);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        if (texture) {
+            if (texture->GetID() == 0)
+                textureLoader.Load(texture);
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, texture->GetID());
+        }
+
+        // billboard axes are the camera right and up vectors
+        float modelview[16];
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        Vector<3,float> right(modelview[0], modelview[4], modelview[8]);
+        Vector<3,float> up(modelview[1], modelview[5], modelview[9]);
+
+        const std::vector<unsigned int>& running = group.GetRunning();
+        glBegin(GL_QUADS);
+        for (unsigned int e = 0; e < running.size(); e++) {
+            const T* p = group.GetParticles(running[e]);
+            const unsigned int count = group.GetEmitter(running[e]).count;
+            for (unsigned int i = 0; i < count; i++) {
+                Vector<3,float> a = right * p[i].size;
+                Vector<3,float> b = up * p[i].size;
+                glColor4f(p[i].color[0], p[i].color[1], p[i].color[2], p[i].color[3]);
+
+                Vector<3,float> v;
+                v = p[i].position - a - b;
+                glTexCoord2f(0.0, 0.0);
+                glVertex3f(v[0], v[1], v[2]);
+                v = p[i].position - a + b;
+                glTexCoord2f(0.0, 1.0);
+                glVertex3f(v[0], v[1], v[2]);
+                v = p[i].position + a + b;
+                glTexCoord2f(1.0, 1.0);
+                glVertex3f(v[0], v[1], v[2]);
+                v = p[i].position + a - b;
+                glTexCoord2f(1.0, 0.0);
+                glVertex3f(v[0], v[1], v[2]);
+            }
+        }
+        glEnd();
+
+        if (texture) glDisable(GL_TEXTURE_2D);
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+        glPopAttrib();
+
+        VisitSubNodes(*view);
+    }
+};
+
+#endif
@@ -14,7 +14,6 @@
 #include <ParticleSystem/Particles/Life.h>
 #include <ParticleSystem/Particles/Color.h>
 #include <ParticleSystem/Particles/Size.h>
-#include <ParticleSystem/Particles/Texture.h>
 
 // predefined modifiers
 #include <ParticleSystem/StaticForceModifier.h>
@@ -25,7 +24,6 @@
 #include <ParticleSystem/TextureRotationModifier.h>
 
 // predefined initializers
-#include <ParticleSystem/RandomTextureInitializer.h>
 //#include <ParticleSystem/RandomLifespanInitializer.h>
 //#include <ParticleSystem/RandomVerletInitializer.h>
 
@@ -34,14 +32,20 @@
 #include <Renderers/IRenderNode.h>
 #include <Scene/ISceneNode.h>
 
-#include <Renderers/OpenGL/TextureLoader.h>
-#include <Resources/ITextureResource.h>
+#include <Renderers/TextureLoader.h>
+#include <Resources/ITexture2D.h>
 #include <Resources/ResourceManager.h>
 
 #include <Meta/OpenGL.h>
 
 #include <Math/RandomGenerator.h>
 
+#include "VectorFieldModifier.h"
+#include "EmissionShapes.h"
+#include "TextureAtlas.h"
+#include "ModifierPipeline.h"
+#include "FrameBudgetGovernor.h"
+
 using namespace OpenEngine::Renderers;
 using namespace OpenEngine::Scene;
 using namespace OpenEngine::ParticleSystem;
@@ -49,71 +53,103 @@ using namespace OpenEngine::Resources;
 using namespace OpenEngine::Renderers::OpenGL;
 using namespace OpenEngine::Math;
 
-typedef Color < Texture <Size < PreviousPosition < Position < Life < IParticle > > > > > >  TYPE;
+typedef Color < AtlasFrame <Size < PreviousPosition < Position < Life < IParticle > > > > > >  TYPE;
+
+typedef Fused < RotationStage < ColorStage < TimeCorrectedVerletStage < SizeStage < TurbulenceStage < Pipeline<TYPE> > > > > > > FirePipeline;
 
-class FireNode : public IRenderNode, public IParticleEffect {
+/**
+ * Fire drawn from an atlas, governable by a FrameBudgetGovernor.
+ *
+ * Quality scales the emission count and the particle cap. Below half
+ * quality only every n-th particle is drawn as well, enlarged to cover
+ * about the same area (level of detail).
+ */
+class FireNode : public IRenderNode, public IParticleEffect, public IGovernable {
 private:
     ParticleCollection<TYPE>* particles;
 
+    // governed quality, and the particle stride and size scale drawn
+    float quality;
+    unsigned int lodStride;
+    float lodScale;
+
     ParticleSystem* system;
 
+    //all textures of the effect packed in one
+    TextureAtlas atlas;
+    TextureLoader& textureLoader;
+
     //initializers
-    RandomTextureInitializer<TYPE> inittex;
+    RandomFrameInitializer<TYPE> initframe;
 
     //modifiers
-    VerletModifier<TYPE> verlet;
+    FirePipeline pipeline;
     StaticForceModifier<TYPE> wind, antigravity;
-    SizeModifier<TYPE> sizemod;
-    LinearColorModifier<TYPE> colormod;
-    LifespanModifier<TYPE> lifemod;
-    TextureRotationModifier<TYPE> rotationmod;
+
+    //emission shapes, positions on a square and directions in a cone
+    BoxShape square;
+    ConeShape cone;
+    std::vector<Vector<3,float> > emitPositions, emitDirections;
 
     RandomGenerator randomgen;
 
     
 public:
-    FireNode(ParticleSystem* system): 
+    FireNode(ParticleSystem* system, TextureLoader& textureLoader): 
+        quality(1.0),
+        lodStride(1),
+        lodScale(1.0),
         system(system),
+        textureLoader(textureLoader),
         wind(Vector<3,float>(1.591,0,0)),
         antigravity(Vector<3,float>(0,0.382,0)),
-        sizemod(20.0){
+        square(Vector<3,float>(0.0, -30.0, -50.0),
+               Vector<3,float>(20.0,0.0,0.0),
+               Vector<3,float>(0.0,0.0,20.0),
+               Vector<3,float>(0.0,0.0,0.0)),
+        cone(Vector<3,float>(0.0, -30.0, -50.0),
+             Vector<3,float>(0.0,1.0,0.0),
+             0.25*PI) {
         particles = system->CreateParticles<TYPE>(500);     
+        emitPositions.resize(particles->GetSize());
+        emitDirections.resize(particles->GetSize());
         
-        //load texture resource
-        ITextureResourcePtr texr1 = ResourceManager<ITextureResource>::Create("Smoke/smoke01.tga");
-        ITextureResourcePtr texr2 = ResourceManager<ITextureResource>::Create("Smoke/smoke02.tga");
-        ITextureResourcePtr texr3 = ResourceManager<ITextureResource>::Create("Smoke/smoke03.tga");
-
-        //inittex.AddTextureResource(texr1);
-        //inittex.AddTextureResource(texr2);
-        inittex.AddTextureResource(texr3);
+        //load textures into the atlas
+        //atlas.AddTexture(ResourceManager<ITexture2D>::Create("Smoke/smoke01.tga"));
+        //atlas.AddTexture(ResourceManager<ITexture2D>::Create("Smoke/smoke02.tga"));
+        unsigned int first = 
+            atlas.AddTexture(ResourceManager<ITexture2D>::Create("Smoke/smoke03.tga"));
+        atlas.Build();
+        initframe.SetFrames(first, atlas.GetNumFrames());
         
         randomgen.SeedWithTime();
+
+        pipeline.size = SizeModifier<TYPE>(20.0);
+        // fast particles are split into up to 4 steps of 5 units
+        pipeline.SetAdaptive(5.0, 4);
+
+        // bake the turbulence once, particles only do a lookup
+        pipeline.turbulence = 
+            VectorFieldModifier<TYPE>(Vector<3,float>(0.0, -30.0, -50.0), 4.0, 0.0005);
+        pipeline.turbulence.BakeCurlNoise(32, 4, randomgen);
+        pipeline.turbulence.SetScroll(Vector<3,float>(0.0, 0.01, 0.0));
 }
 
 ~FireNode() {
     delete[] particles;
 }
+
+void SetQuality(float quality) {
+    this->quality = quality;
+    lodStride = std::max(1u, unsigned(0.5 / quality));
+    lodScale = std::sqrt(float(lodStride));
+}
  
 void Handle(ParticleEventArg e) {
     Emit();
 
-    for (particles->iterator.Reset(); 
-         particles->iterator.HasNext(); 
-         particles->iterator.Next()) {
-        TYPE& particle = particles->iterator.Element();
-        
-        // custom modify particles
-
-        // predefined particle modifiers
-        // wind.Process(e.dt, particle);
-        // antigravity.Process(e.dt, particle);
-        sizemod.Process(particle);
-        verlet.Process(e.dt, particle);
-        colormod.Process(particle);
-        rotationmod.Process(particle);
-        lifemod.Process(e.dt, particles->iterator);
-    }
+    // turbulence, size, verlet, color and rotation in one pass
+    pipeline.Process(e.dt, *particles);
 }
 
 inline float RandomAttribute(float base, float variance) {
@@ -122,25 +158,21 @@ inline float RandomAttribute(float base, float variance) {
 }
 
 void inline Emit() {
-    if (particles->GetActiveParticles() >= particles->GetSize())
+    const unsigned int cap = std::max(1u, unsigned(particles->GetSize() * quality));
+    if (particles->GetActiveParticles() >= cap)
         return;
     
     // initializer variables
     static const float number = 7;
     static const float numberVar = 2;
     
-    // attributes for emission on square
-    static const Vector<3,float> position(0.0, -30.0, -50.0);
-    static const Vector<3,float> devAxis1(20.0,0.0,0.0);
-    static const Vector<3,float> devAxis2(0.0,0.0,20.0);        
-    
     static const float life = 2100;
     static const float lifeVar = 1000;
     
     static const float size = 7;
     static const float sizeVar = 2;
     
-    static const Vector<3,float> velocity(0.0,2.0,0.0);
+    static const float speed = 2.0;
     
     // angle is the angular deviation from the direction of
     // the velocity
@@ -151,15 +183,20 @@ void inline Emit() {
     static const float spinVar = 0.1;
     
 
-    int emits = min(unsigned(round(RandomAttribute(number, numberVar))),
-                    particles->GetSize()-particles->GetActiveParticles());
+    int emits = min(unsigned(round(RandomAttribute(number, numberVar) * quality)),
+                    cap - particles->GetActiveParticles());
+    if (emits <= 0)
+        return;
+
+    // sample the shapes for the whole batch
+    cone.SetAngle(RandomAttribute(angle, angleVar));
+    square.Sample(randomgen, emits, &emitPositions[0], NULL);
+    cone.Sample(randomgen, emits, NULL, &emitDirections[0]);
     
     for (int i = 0; i < emits; i++) {
         TYPE& particle = particles->NewParticle();
         
-        // static pos
-        particle.position = position + devAxis1*randomgen.UniformFloat(-1.0,1.0) 
-            + devAxis2*randomgen.UniformFloat(-1.0,1.0);
+        particle.position = emitPositions[i];
             
         particle.life = 0;
         particle.maxlife = RandomAttribute(life, lifeVar);
@@ -172,18 +209,12 @@ void inline Emit() {
         particle.endColor = Vector<4,float>(0.1,0.1,0.1,0.1);
 
         // texture
-        inittex.Process(particle);
-    
-        // random direction
-        float r = (rand()/((float)RAND_MAX))*RandomAttribute(angle, angleVar);
-        float p = (rand()/((float)RAND_MAX))*2*PI;
-        Quaternion<float> q(r,p, 0);
-        q.Normalize();
+        initframe.Process(particle);
     
         // set the previous position
         // this will represent direction and speed when using verlet 
         // integration for updating position
-        particle.previousPosition = particle.position - (q.RotateVector(velocity));
+        particle.previousPosition = particle.position - emitDirections[i] * speed;
     }
 }
 
@@ -197,65 +228,51 @@ void Apply(IRenderingView* view) {
     glEnable(GL_COLOR_MATERIAL);
     glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
     
+    ITexture2DPtr tex = atlas.GetTexture();
+    if (tex->GetID() == 0)
+        textureLoader.Load(tex);
+    glBindTexture(GL_TEXTURE_2D, tex->GetID());
+
+    // billboard axes are the camera right and up vectors
+    float modelview[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    Vector<3,float> right(modelview[0], modelview[4], modelview[8]);
+    Vector<3,float> up(modelview[1], modelview[5], modelview[9]);
+
+    // all particles in one batch, the frame selects the texture
+    glBegin(GL_QUADS);
+    unsigned int n = 0;
     for (particles->iterator.Reset(); particles->iterator.HasNext(); particles->iterator.Next()) {
+        if (n++ % lodStride != 0) continue;
         TYPE& particle = particles->iterator.Element();
-        ITextureResourcePtr texr = particle.texture;
-            
-        //Set texture
-        if (texr != NULL) {
-            if (texr->GetID() == 0) {
-                TextureLoader::LoadTextureResource(texr);
-                //logger.info << texr->GetID() << logger.end;
-            }
-            glBindTexture(GL_TEXTURE_2D, texr->GetID());
-        }
-            
-        else {
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
-            
-        glPushMatrix();
-        glTranslatef(particle.position[0], particle.position[1], particle.position[2]);
-            
-        // billboard
-        float modelview[16];
-        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
-//         for( int i=0; i<3; i++ )
-//             for( int j=0; j<3; j++ ) {
-//                 if ( i==j )
-//                     modelview[i*4+j] = 1.0;
-//                 else
-//                     modelview[i*4+j] = 0.0;
-//             }
-        modelview[0] = modelview[5] = modelview[10] = 1.0;
-        modelview[1] = modelview[2] = modelview[4] = modelview[6] = modelview[8] = modelview[9] = 0.0; 
-        
-        glLoadMatrixf(modelview);
-            
-        glRotatef(particle.rotation, 0,0,1);
-            
-        float scale = particle.size;
-        glScalef(scale,scale,scale);
-            
+        const Vector<4,float>& uv = atlas.GetFrame(particle.frame);
+
+        float angle = particle.rotation * PI / 180.0;
+        float cs = cos(angle) * particle.size * lodScale;
+        float sn = sin(angle) * particle.size * lodScale;
+        Vector<3,float> a = right * cs + up * sn;
+        Vector<3,float> b = up * cs - right * sn;
+
         // color
         float c[4];
         particle.color.ToArray(c);
         glColor4fv(c);
-            
-        glBegin(GL_QUADS);
-        glTexCoord2f(0.0, 0.0);
-        glVertex3f(-1.0, -1.0, 0.0);
-        glTexCoord2f(0.0, 1.0);
-        glVertex3f(-1.0, 1.0, 0);
-        glTexCoord2f(1.0, 1.0);
-        glVertex3f(1, 1, 0);
-        glTexCoord2f(1.0, 0.0);
-        glVertex3f(1, -1, 0);
-            
-        glEnd();
-            
-        glPopMatrix();
+
+        Vector<3,float> v;
+        v = particle.position - a - b;
+        glTexCoord2f(uv[0], uv[1]);
+        glVertex3f(v[0], v[1], v[2]);
+        v = particle.position - a + b;
+        glTexCoord2f(uv[0], uv[3]);
+        glVertex3f(v[0], v[1], v[2]);
+        v = particle.position + a + b;
+        glTexCoord2f(uv[2], uv[3]);
+        glVertex3f(v[0], v[1], v[2]);
+        v = particle.position + a - b;
+        glTexCoord2f(uv[2], uv[1]);
+        glVertex3f(v[0], v[1], v[2]);
     }
+    glEnd();
         
     glDisable(GL_BLEND);
     glPopAttrib();
@@ -268,6 +285,10 @@ ISceneNode* GetSceneNode() {
     return this;
 }
 
+ParticleCollection<TYPE>* GetParticles() {
+    return particles;
+}
+
 };
 
 #endif
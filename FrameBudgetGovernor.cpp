@@ -0,0 +1,121 @@
+// frame time budget for particle effects
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include "FrameBudgetGovernor.h"
+
+#include <Effects/SimpleEmitter.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+
+SimpleEmitterGovernable::SimpleEmitterGovernable(SimpleEmitter& emitter)
+    : emitter(emitter),
+      baseParticles(emitter.GetNumParticles()),
+      baseInterval(emitter.GetEmitInterval()),
+      quality(1.0) {}
+
+void SimpleEmitterGovernable::Apply() {
+    emitter.SetNumParticles(std::max(1u, unsigned(baseParticles * quality)));
+    emitter.SetEmitInterval(baseInterval / quality);
+}
+
+void SimpleEmitterGovernable::SetQuality(float quality) {
+    this->quality = quality;
+    Apply();
+}
+
+void SimpleEmitterGovernable::SetNumParticles(unsigned int particles) {
+    baseParticles = particles;
+    Apply();
+}
+
+void SimpleEmitterGovernable::SetEmitInterval(float interval) {
+    baseInterval = interval;
+    Apply();
+}
+
+FrameBudgetGovernor::FrameBudgetGovernor(float budget, float hysteresis)
+    : budget(budget), hysteresis(hysteresis), minQuality(0.1),
+      cost(0.0), cooldown(0), settleFrames(15) {}
+
+unsigned int FrameBudgetGovernor::AddEffect(std::string name,
+                                            IGovernable* target,
+                                            int priority) {
+    Effect e;
+    e.name = name;
+    e.target = target;
+    e.priority = priority;
+    e.quality = 1.0;
+    e.cost = 0.0;
+    e.frameUs = 0;
+    effects.push_back(e);
+    return effects.size() - 1;
+}
+
+void FrameBudgetGovernor::SetQuality(unsigned int id, float quality) {
+    Effect& e = effects[id];
+    e.quality = quality;
+    e.target->SetQuality(quality);
+    cooldown = settleFrames;
+
+    GovernorEventArg arg;
+    arg.effect = id;
+    arg.name = e.name;
+    arg.quality = quality;
+    arg.cost = cost;
+    arg.budget = budget;
+    decisionEvent.Notify(arg);
+    logger.info << "FrameBudgetGovernor: " << e.name << " quality "
+                << quality << " (" << cost << "/" << budget << " ms)"
+                << logger.end;
+}
+
+void FrameBudgetGovernor::Handle(ProcessEventArg arg) {
+    // smooth the measurements of the frame
+    cost = 0.0;
+    for (unsigned int i = 0; i < effects.size(); i++) {
+        Effect& e = effects[i];
+        e.cost = 0.9 * e.cost + 0.1 * (e.frameUs / 1000.0);
+        e.frameUs = 0;
+        cost += e.cost;
+    }
+
+    if (cooldown > 0) {
+        cooldown--;
+        return;
+    }
+
+    if (cost > budget * (1.0 + hysteresis)) {
+        // cheapest loss first: lowest priority, then most expensive
+        int pick = -1;
+        for (unsigned int i = 0; i < effects.size(); i++) {
+            Effect& e = effects[i];
+            if (!e.target || e.quality <= minQuality) continue;
+            if (pick < 0 || e.priority < effects[pick].priority ||
+                (e.priority == effects[pick].priority && e.cost > effects[pick].cost))
+                pick = i;
+        }
+        // cut in proportion to the overrun so a burst of effects is
+        // brought down in a few steps
+        if (pick >= 0)
+            SetQuality(pick, std::max(minQuality,
+                                      effects[pick].quality * std::max(0.5f, budget / cost)));
+    }
+    else if (cost < budget * (1.0 - hysteresis)) {
+        int pick = -1;
+        for (unsigned int i = 0; i < effects.size(); i++) {
+            Effect& e = effects[i];
+            if (!e.target || e.quality >= 1.0) continue;
+            if (pick < 0 || e.priority > effects[pick].priority)
+                pick = i;
+        }
+        if (pick >= 0)
+            SetQuality(pick, std::min(1.0f, effects[pick].quality + 0.1f));
+    }
+}
@@ -0,0 +1,223 @@
+// frame time budget for particle effects
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_FRAME_BUDGET_GOVERNOR_H_
+#define _OESIM_FRAME_BUDGET_GOVERNOR_H_
+
+#include <Core/IListener.h>
+#include <Core/IEngine.h>
+#include <Core/Event.h>
+#include <Renderers/IRenderNode.h>
+#include <Renderers/IRenderingView.h>
+#include <Utils/Timer.h>
+
+#include <vector>
+#include <string>
+
+namespace OpenEngine {
+    namespace Effects {
+        class SimpleEmitter;
+    }
+}
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::IEvent;
+using OpenEngine::Core::Event;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Utils::Timer;
+using OpenEngine::Renderers::IRenderNode;
+using OpenEngine::Renderers::IRenderingView;
+using OpenEngine::Effects::SimpleEmitter;
+
+/**
+ * An effect whose cost can be scaled by the governor.
+ * Quality is in (0,1], 1 being the configured look of the effect.
+ * How it is scaled is up to the effect: emission rate, particle
+ * count, or level of detail when drawing (see FireNode).
+ */
+class IGovernable {
+public:
+    virtual ~IGovernable() {}
+    virtual void SetQuality(float quality) = 0;
+};
+
+/**
+ * Scales the particle count and emission rate of a SimpleEmitter
+ * relative to its configured values.
+ *
+ * The configured values are read from the emitter when the adapter
+ * is created. Change them through the adapter afterwards, setting them
+ * on the emitter directly is overwritten by the next decision.
+ */
+class SimpleEmitterGovernable : public IGovernable {
+private:
+    SimpleEmitter& emitter;
+    unsigned int baseParticles;
+    float baseInterval;
+    float quality;
+
+    void Apply();
+public:
+    SimpleEmitterGovernable(SimpleEmitter& emitter);
+    void SetQuality(float quality);
+
+    unsigned int GetNumParticles() { return baseParticles; }
+    void SetNumParticles(unsigned int particles);
+    float GetEmitInterval() { return baseInterval; }
+    void SetEmitInterval(float interval);
+};
+
+/**
+ * Sent when the governor changes the quality of an effect.
+ */
+struct GovernorEventArg {
+    unsigned int effect;
+    std::string name;
+    float quality;
+    float cost;       // smoothed cost of all effects in ms
+    float budget;     // ms
+};
+
+/**
+ * Keeps the particle effects within a per frame time budget.
+ *
+ * Update and render cost is measured per effect by attaching the
+ * effect and its renderer through the proxies from TimeUpdate() and
+ * TimeRender(). A renderer shared by several effects, like the post
+ * process ParticleRenderer, can only be charged to one of them;
+ * effects that are render nodes of their own are timed per node.
+ * Once a frame (engine ProcessEvent) the smoothed total is compared to
+ * the budget. Above budget*(1+hysteresis) the lowest priority effect
+ * still above minimum quality is scaled down, below
+ * budget*(1-hysteresis) the highest priority effect not at full
+ * quality is scaled back up. After each decision the governor waits a
+ * number of frames for the measurements to settle, so the two never
+ * alternate frame by frame.
+ */
+class FrameBudgetGovernor : public IListener<ProcessEventArg> {
+public:
+    struct Effect {
+        std::string name;
+        IGovernable* target;
+        int priority;
+        float quality;
+        float cost;           // smoothed ms per frame
+        unsigned int frameUs; // measured this frame
+    };
+
+private:
+    std::vector<Effect> effects;
+    Event<GovernorEventArg> decisionEvent;
+    float budget, hysteresis, minQuality;
+    float cost;
+    unsigned int cooldown, settleFrames;
+
+    void SetQuality(unsigned int id, float quality);
+
+public:
+    /**
+     * @param budget frame budget for all governed effects in ms
+     */
+    FrameBudgetGovernor(float budget = 8.0, float hysteresis = 0.15);
+
+    /**
+     * Register an effect. Higher priority effects are reduced last
+     * and restored first. A NULL target is only measured.
+     */
+    unsigned int AddEffect(std::string name, IGovernable* target, int priority = 0);
+
+    /**
+     * Proxy to attach in place of the listener, e.g.
+     * particleSystem.ProcessEvent().Attach(*governor.TimeUpdate(id, emitter))
+     */
+    template <class EventArg>
+    IListener<EventArg>* TimeUpdate(unsigned int id, IListener<EventArg>& listener);
+    template <class EventArg>
+    IListener<EventArg>* TimeRender(unsigned int id, IListener<EventArg>& listener) {
+        return TimeUpdate(id, listener);
+    }
+
+    /**
+     * Render node to add to the scene in place of the node, e.g.
+     * scene->AddNode(governor.TimeRender(id, *fireNode))
+     */
+    IRenderNode* TimeRender(unsigned int id, IRenderNode& node);
+
+    void AddCost(unsigned int id, unsigned int microseconds) {
+        effects[id].frameUs += microseconds;
+    }
+
+    void Handle(ProcessEventArg arg);
+
+    IEvent<GovernorEventArg>& DecisionEvent() { return decisionEvent; }
+
+    float GetBudget() { return budget; }
+    void SetBudget(float budget) { this->budget = budget; }
+    float GetHysteresis() { return hysteresis; }
+    void SetHysteresis(float hysteresis) { this->hysteresis = hysteresis; }
+    float GetCost() { return cost; }
+    const std::vector<Effect>& GetEffects() { return effects; }
+};
+
+/**
+ * Forwards an event and charges the time spent to a governed effect.
+ */
+template <class EventArg>
+class TimedListener : public IListener<EventArg> {
+private:
+    FrameBudgetGovernor& governor;
+    unsigned int id;
+    IListener<EventArg>& listener;
+    Timer timer;
+public:
+    TimedListener(FrameBudgetGovernor& governor, unsigned int id,
+                  IListener<EventArg>& listener)
+        : governor(governor), id(id), listener(listener) {}
+
+    void Handle(EventArg arg) {
+        timer.Reset();
+        timer.Start();
+        listener.Handle(arg);
+        governor.AddCost(id, timer.GetElapsedIntervals(1));
+    }
+};
+
+/**
+ * Renders a node and charges the time spent to a governed effect.
+ */
+class TimedRenderNode : public IRenderNode {
+private:
+    FrameBudgetGovernor& governor;
+    unsigned int id;
+    IRenderNode& node;
+    Timer timer;
+public:
+    TimedRenderNode(FrameBudgetGovernor& governor, unsigned int id,
+                    IRenderNode& node)
+        : governor(governor), id(id), node(node) {}
+
+    void Apply(IRenderingView* view) {
+        timer.Reset();
+        timer.Start();
+        node.Apply(view);
+        governor.AddCost(id, timer.GetElapsedIntervals(1));
+    }
+};
+
+inline IRenderNode* FrameBudgetGovernor::TimeRender(unsigned int id, IRenderNode& node) {
+    return new TimedRenderNode(*this, id, node);
+}
+
+template <class EventArg>
+IListener<EventArg>* FrameBudgetGovernor::TimeUpdate(unsigned int id,
+                                                     IListener<EventArg>& listener) {
+    return new TimedListener<EventArg>(*this, id, listener);
+}
+
+#endif
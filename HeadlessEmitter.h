@@ -0,0 +1,116 @@
+// emitter for a headless simulation publishing to a particle stream
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_HEADLESS_EMITTER_H_
+#define _OESIM_HEADLESS_EMITTER_H_
+
+#include <ParticleSystem/ParticleSystem.h>
+#include <ParticleSystem/Particles/IParticle.h>
+#include <ParticleSystem/Particles/Position.h>
+#include <ParticleSystem/Particles/PreviousPosition.h>
+#include <ParticleSystem/Particles/Life.h>
+#include <ParticleSystem/Particles/Color.h>
+#include <ParticleSystem/Particles/Size.h>
+#include <Core/IListener.h>
+#include <Math/Vector.h>
+#include <Math/RandomGenerator.h>
+
+#include "EmitterGroup.h"
+#include "EmissionShapes.h"
+#include "ModifierPipeline.h"
+#include "ParticleStream.h"
+
+#include <string>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Math::Vector;
+using OpenEngine::Math::RandomGenerator;
+using OpenEngine::ParticleSystem::ParticleEventArg;
+using OpenEngine::ParticleSystem::IParticle;
+using OpenEngine::ParticleSystem::Position;
+using OpenEngine::ParticleSystem::PreviousPosition;
+using OpenEngine::ParticleSystem::Life;
+using OpenEngine::ParticleSystem::Color;
+using OpenEngine::ParticleSystem::Size;
+
+typedef Color < Size < PreviousPosition < Position < Life < IParticle > > > > > StreamParticle;
+
+typedef Fused < ColorStage < SizeStage < VerletStage < Pipeline<StreamParticle> > > > > StreamPipeline;
+
+/**
+ * Emits from a ball around the emitter position, radially outwards.
+ */
+class StreamParticleInitializer {
+private:
+    SphereShape ball;
+    RandomGenerator random;
+    float speed, life, size;
+
+public:
+    StreamParticleInitializer(float radius, float speed, float life, float size)
+        : ball(Vector<3,float>(), radius), speed(speed), life(life), size(size) {
+        random.SeedWithTime();
+    }
+
+    inline void Process(StreamParticle& particle, const GroupEmitter& emitter) {
+        Vector<3,float> position, direction;
+        ball.Sample(random, 1, &position, &direction);
+        particle.position = emitter.position + position;
+        particle.previousPosition = particle.position - direction * speed;
+        particle.life = 0;
+        particle.maxlife = life;
+        particle.size = particle.startsize = size;
+        particle.color = particle.startColor = Vector<4,float>(0.85,0.1,0.0,0.8);
+        particle.endColor = Vector<4,float>(0.1,0.1,0.1,0.1);
+    }
+};
+
+/**
+ * A single emitter simulated without any display, which publishes its
+ * particles every tick into a shared memory particle stream. Run it in
+ * a process started with --publish and view the stream from another
+ * process with a ParticleStreamNode (--view).
+ *
+ * Attach it to ParticleSystem::ProcessEvent.
+ */
+class HeadlessEmitter : public IListener<ParticleEventArg> {
+private:
+    StreamParticleInitializer init;
+    StreamPipeline pipeline;
+    EmitterGroup<StreamParticle, StreamParticleInitializer, StreamPipeline> group;
+    ParticleStreamWriter<StreamParticle> writer;
+    unsigned int emitter;
+
+public:
+    /**
+     * @param name name of the shared memory stream
+     * @param capacity max live particles
+     * @param emitRate particles per unit of ParticleEventArg::dt
+     */
+    HeadlessEmitter(std::string name, unsigned int capacity, float emitRate)
+        : init(10.0, 2.0, 2100, 7),
+          group(init, pipeline),
+          writer(name, capacity) {
+        pipeline.size = SizeModifier<StreamParticle>(20.0);
+        emitter = group.AddEmitter(capacity, Vector<3,float>(), emitRate);
+        group.SetActive(emitter, true);
+    }
+
+    void SetPosition(Vector<3,float> position) {
+        group.GetEmitter(emitter).position = position;
+    }
+
+    void Handle(ParticleEventArg e) {
+        group.Handle(e);
+        writer.Publish(e.dt, group.GetParticles(emitter),
+                       group.GetEmitter(emitter).count);
+    }
+};
+
+#endif
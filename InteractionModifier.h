@@ -0,0 +1,269 @@
+// short range particle-particle interaction
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_INTERACTION_MODIFIER_H_
+#define _OESIM_INTERACTION_MODIFIER_H_
+
+#include <ParticleSystem/ParticleCollection.h>
+#include <Math/Vector.h>
+#include <Math/Math.h>
+
+#include <vector>
+#include <cmath>
+
+using OpenEngine::ParticleSystem::ParticleCollection;
+using OpenEngine::Math::Vector;
+
+/**
+ * Separation, cohesion and SPH density/pressure between particles
+ * closer than the interaction radius.
+ *
+ * Unlike the other modifiers this one needs all particles of a tick at
+ * once, so it is called once per tick before the per particle loop:
+ *
+ *   void Handle(ParticleEventArg e) {
+ *       interaction.Process(e.dt, *particles);
+ *       for (particles->iterator.Reset(); ...
+ *
+ * Every tick the positions are bucketed by a spatial hash with cell
+ * size equal to the radius and counting sorted into a cell list, so
+ * neighbours are found in the 27 surrounding cells in O(n) expected
+ * time. Several cells may share a bucket, so candidates are checked
+ * against the cell being visited; a neighbour is never counted twice.
+ * The sorted positions are kept in separate x, y, z arrays and the
+ * density and force passes only write their own particle, so both
+ * passes run in parallel when built with OpenMP.
+ *
+ * Forces change the Verlet velocity, that is they move
+ * previousPosition, so run the VerletModifier afterwards.
+ */
+template <class T>
+class InteractionModifier {
+private:
+    float radius, invRadius;
+    float separation, cohesion;
+    float stiffness, restDensity, viscosity;
+    bool sph;
+
+    // particles of this tick in sorted order
+    std::vector<T*> items;
+    std::vector<float> x, y, z;
+    std::vector<int> ci, cj, ck;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> density;
+    std::vector<float> dx, dy, dz;
+
+    // counting sort scratch, bucket b holds sorted particles
+    // [bucketStart[b] .. bucketStart[b+1])
+    std::vector<unsigned int> keys;
+    std::vector<unsigned int> bucketStart;
+    std::vector<T*> unsorted;
+    unsigned int mask;
+
+    static inline unsigned int Hash(int i, int j, int k) {
+        // unsigned, the products overflow for most cell indices
+        return (unsigned int)i * 73856093u ^ (unsigned int)j * 19349663u
+            ^ (unsigned int)k * 83492791u;
+    }
+
+    inline int Cell(float v) const {
+        return int(std::floor(v * invRadius));
+    }
+
+    inline bool InCell(unsigned int s, int i, int j, int k) const {
+        return ci[s] == i && cj[s] == j && ck[s] == k;
+    }
+
+    void Sort() {
+        const unsigned int n = unsorted.size();
+        unsigned int tableSize = 1;
+        while (tableSize < 2*n) tableSize <<= 1;
+        mask = tableSize - 1;
+
+        keys.resize(n);
+        bucketStart.assign(tableSize + 1, 0);
+        for (unsigned int i = 0; i < n; i++) {
+            const Vector<3,float>& p = unsorted[i]->position;
+            keys[i] = Hash(Cell(p[0]), Cell(p[1]), Cell(p[2])) & mask;
+            bucketStart[keys[i]+1]++;
+        }
+        for (unsigned int b = 0; b < tableSize; b++)
+            bucketStart[b+1] += bucketStart[b];
+
+        items.resize(n);
+        std::vector<unsigned int> fill(bucketStart.begin(), bucketStart.end()-1);
+        for (unsigned int i = 0; i < n; i++)
+            items[fill[keys[i]]++] = unsorted[i];
+
+        x.resize(n); y.resize(n); z.resize(n);
+        ci.resize(n); cj.resize(n); ck.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+        for (unsigned int i = 0; i < n; i++) {
+            const T& p = *items[i];
+            x[i] = p.position[0];
+            y[i] = p.position[1];
+            z[i] = p.position[2];
+            ci[i] = Cell(x[i]);
+            cj[i] = Cell(y[i]);
+            ck[i] = Cell(z[i]);
+            vx[i] = p.position[0] - p.previousPosition[0];
+            vy[i] = p.position[1] - p.previousPosition[1];
+            vz[i] = p.position[2] - p.previousPosition[2];
+        }
+    }
+
+    void Densities() {
+        // poly6 kernel with unit mass
+        const float h2 = radius*radius;
+        const float poly6 = 315.0 / (64.0 * OpenEngine::Math::PI * std::pow(radius, 9));
+        const int n = items.size();
+        density.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            float rho = 0.0;
+            for (int c = 0; c < 27; c++) {
+                int a = ci[i] + c%3 - 1, b = cj[i] + (c/3)%3 - 1, d = ck[i] + c/9 - 1;
+                unsigned int bucket = Hash(a,b,d) & mask;
+                for (unsigned int j = bucketStart[bucket]; j < bucketStart[bucket+1]; j++) {
+                    if (!InCell(j, a, b, d)) continue;
+                    float rx = x[i]-x[j], ry = y[i]-y[j], rz = z[i]-z[j];
+                    float r2 = rx*rx + ry*ry + rz*rz;
+                    if (r2 < h2) {
+                        float w = h2 - r2;
+                        rho += w*w*w;
+                    }
+                }
+            }
+            density[i] = rho * poly6;
+        }
+    }
+
+    void Forces(float dt) {
+        const float h2 = radius*radius;
+        const float spiky = -45.0 / (OpenEngine::Math::PI * std::pow(radius, 6));
+        const float viscLap = 45.0 / (OpenEngine::Math::PI * std::pow(radius, 6));
+        const int n = items.size();
+        dx.resize(n); dy.resize(n); dz.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++) {
+            float fx = 0.0, fy = 0.0, fz = 0.0;
+            float cx = 0.0, cy = 0.0, cz = 0.0;
+            unsigned int neighbours = 0;
+            float pi = sph ? stiffness * (density[i] - restDensity) : 0.0;
+            for (int c = 0; c < 27; c++) {
+                int a = ci[i] + c%3 - 1, b = cj[i] + (c/3)%3 - 1, d = ck[i] + c/9 - 1;
+                unsigned int bucket = Hash(a,b,d) & mask;
+                for (unsigned int j = bucketStart[bucket]; j < bucketStart[bucket+1]; j++) {
+                    if (!InCell(j, a, b, d)) continue;
+                    float rx = x[i]-x[j], ry = y[i]-y[j], rz = z[i]-z[j];
+                    float r2 = rx*rx + ry*ry + rz*rz;
+                    if (r2 >= h2 || int(j) == i) continue;
+                    float r = std::sqrt(r2);
+                    float q = radius - r;
+                    float inv = r > 1e-6 ? 1.0 / r : 0.0;
+                    neighbours++;
+                    cx += x[j]; cy += y[j]; cz += z[j];
+
+                    // linear falloff push away from the neighbour
+                    float s = separation * q * invRadius * inv;
+                    fx += rx*s; fy += ry*s; fz += rz*s;
+
+                    if (sph && density[j] > 0.0) {
+                        float pj = stiffness * (density[j] - restDensity);
+                        float p = -spiky * q*q * (pi + pj) / (2.0*density[j]) * inv;
+                        fx += rx*p; fy += ry*p; fz += rz*p;
+                        float v = viscosity * viscLap * q / density[j];
+                        fx += (vx[j]-vx[i])*v;
+                        fy += (vy[j]-vy[i])*v;
+                        fz += (vz[j]-vz[i])*v;
+                    }
+                }
+            }
+            if (sph && density[i] > 0.0) {
+                float inv = 1.0 / density[i];
+                fx *= inv; fy *= inv; fz *= inv;
+            }
+            if (neighbours > 0 && cohesion != 0.0) {
+                float inv = 1.0 / neighbours;
+                fx += (cx*inv - x[i]) * cohesion;
+                fy += (cy*inv - y[i]) * cohesion;
+                fz += (cz*inv - z[i]) * cohesion;
+            }
+            dx[i] = fx*dt; dy[i] = fy*dt; dz[i] = fz*dt;
+        }
+    }
+
+    void Apply() {
+        const int n = items.size();
+        for (int i = 0; i < n; i++) {
+            Vector<3,float>& prev = items[i]->previousPosition;
+            prev[0] -= dx[i];
+            prev[1] -= dy[i];
+            prev[2] -= dz[i];
+        }
+    }
+
+    void Run(float dt) {
+        if (unsorted.size() < 2) return;
+        Sort();
+        if (sph) Densities();
+        Forces(dt);
+        Apply();
+    }
+
+public:
+    /**
+     * @param radius interaction radius, also the hash cell size
+     * @param separation strength of the push between close particles
+     * @param cohesion pull toward the centre of the neighbourhood
+     */
+    InteractionModifier(float radius,
+                        float separation = 1.0,
+                        float cohesion = 0.0)
+        : radius(radius), invRadius(1.0/radius),
+          separation(separation), cohesion(cohesion),
+          stiffness(0.0), restDensity(0.0), viscosity(0.0),
+          sph(false), mask(0) {}
+
+    /**
+     * Enable SPH pressure and viscosity.
+     * Particles have unit mass.
+     */
+    void SetSPH(float stiffness, float restDensity, float viscosity = 0.0) {
+        this->stiffness = stiffness;
+        this->restDensity = restDensity;
+        this->viscosity = viscosity;
+        sph = true;
+    }
+
+    void DisableSPH() {
+        sph = false;
+    }
+
+    void SetSeparation(float s) { separation = s; }
+    void SetCohesion(float c) { cohesion = c; }
+
+    void Process(float dt, ParticleCollection<T>& particles) {
+        unsorted.clear();
+        for (particles.iterator.Reset();
+             particles.iterator.HasNext();
+             particles.iterator.Next())
+            unsorted.push_back(&particles.iterator.Element());
+        Run(dt);
+    }
+
+    void ProcessBatch(float dt, T* particles, unsigned int count) {
+        unsorted.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+            unsorted[i] = &particles[i];
+        Run(dt);
+    }
+};
+
+#endif
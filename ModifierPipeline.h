@@ -0,0 +1,395 @@
+// fused modifier pipelines
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_MODIFIER_PIPELINE_H_
+#define _OESIM_MODIFIER_PIPELINE_H_
+
+#include <ParticleSystem/ParticleCollection.h>
+#include <ParticleSystem/VerletModifier.h>
+#include <ParticleSystem/StaticForceModifier.h>
+#include <ParticleSystem/SizeModifier.h>
+#include <ParticleSystem/LinearColorModifier.h>
+#include <ParticleSystem/LifespanModifier.h>
+#include <ParticleSystem/TextureRotationModifier.h>
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+
+#include "VectorFieldModifier.h"
+#include "CollisionModifier.h"
+#include "TimeCorrectedVerletModifier.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using OpenEngine::ParticleSystem::ParticleCollection;
+using OpenEngine::ParticleSystem::VerletModifier;
+using OpenEngine::ParticleSystem::StaticForceModifier;
+using OpenEngine::ParticleSystem::SizeModifier;
+using OpenEngine::ParticleSystem::LinearColorModifier;
+using OpenEngine::ParticleSystem::LifespanModifier;
+using OpenEngine::ParticleSystem::TextureRotationModifier;
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+
+/*
+ * Modifier pipelines are composed in the same mixin style as the
+ * particle types, innermost stage first:
+ *
+ *   typedef Fused < ColorStage < VerletStage < SizeStage <
+ *       Pipeline<TYPE> > > > > FirePipeline;
+ *
+ * Every stage inherits the one it wraps and calls it before its own
+ * modifier, so the whole chain is resolved at compile time and inlines
+ * into one loop body. The modifiers are public members of the stages
+ * (pipeline.size, pipeline.color, ...) and live in one object.
+ *
+ * Each stage names the particle attributes it needs. A missing
+ * attribute fails to compile in the stage constructor, in a function
+ * called Particle_lacks_<attribute>.
+ *
+ * Fused::SetAdaptive() re-runs the chain in sub-steps for particles
+ * that move far in a tick. Stages report the distance with Travel()
+ * and get BeginSubSteps()/EndSubSteps() around the sub-steps of a
+ * particle. Stages whose modifier acts once per tick (forces, texture
+ * rotation) apply it in BeginSubSteps() and skip the sub-steps.
+ */
+
+template <class P> inline void Particle_lacks_Position(P& p) {
+    Vector<3,float>& v = p.position; (void)v;
+}
+template <class P> inline void Particle_lacks_PreviousPosition(P& p) {
+    Vector<3,float>& v = p.previousPosition; (void)v;
+}
+template <class P> inline void Particle_lacks_Life(P& p) {
+    float& a = p.life; float& b = p.maxlife; (void)a; (void)b;
+}
+template <class P> inline void Particle_lacks_Size(P& p) {
+    float& a = p.size; float& b = p.startsize; (void)a; (void)b;
+}
+template <class P> inline void Particle_lacks_Color(P& p) {
+    Vector<4,float>& a = p.color; Vector<4,float>& b = p.startColor;
+    Vector<4,float>& c = p.endColor; (void)a; (void)b; (void)c;
+}
+template <class P> inline void Particle_lacks_Rotation(P& p) {
+    float& a = p.rotation; float& b = p.spin; (void)a; (void)b;
+}
+
+// instantiates the check without calling it
+#define PIPELINE_REQUIRES(check) \
+    { void (*f)(Particle&) = &check<Particle>; (void)f; }
+
+/**
+ * Innermost stage, does nothing.
+ */
+template <class T>
+class Pipeline {
+public:
+    typedef T Particle;
+    inline void Update(float dt) {}
+    inline bool Process(float dt, T& particle) { return true; }
+    inline float Travel(const T& particle) { return 0.0; }
+    inline void BeginSubSteps(float dt, unsigned int steps, T& particle) {}
+    inline void EndSubSteps(float dt, unsigned int steps, T& particle) {}
+};
+
+/**
+ * Plain Verlet, the VerletModifier does not support sub-steps so the
+ * stage never asks for them.
+ */
+template <class Base>
+class VerletStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    VerletModifier<Particle> verlet;
+
+    VerletStage() {
+        PIPELINE_REQUIRES(Particle_lacks_Position);
+        PIPELINE_REQUIRES(Particle_lacks_PreviousPosition);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        verlet.Process(dt, particle);
+        return true;
+    }
+};
+
+template <class Base>
+class TimeCorrectedVerletStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    TimeCorrectedVerletModifier<Particle> verlet;
+
+    TimeCorrectedVerletStage() {
+        PIPELINE_REQUIRES(Particle_lacks_Position);
+        PIPELINE_REQUIRES(Particle_lacks_PreviousPosition);
+    }
+    inline void Update(float dt) {
+        Base::Update(dt);
+        verlet.Update(dt);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        verlet.Process(dt, particle);
+        return true;
+    }
+    inline float Travel(const Particle& particle) {
+        return std::max(Base::Travel(particle), verlet.Travel(particle));
+    }
+    inline void BeginSubSteps(float dt, unsigned int steps, Particle& particle) {
+        Base::BeginSubSteps(dt, steps, particle);
+        verlet.BeginSubSteps(dt, steps, particle);
+    }
+    inline void EndSubSteps(float dt, unsigned int steps, Particle& particle) {
+        Base::EndSubSteps(dt, steps, particle);
+        verlet.EndSubSteps(dt, steps, particle);
+    }
+};
+
+template <class Base>
+class ForceStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    StaticForceModifier<Particle> force;
+
+private:
+    float tick;
+
+public:
+    ForceStage() : force(Vector<3,float>()), tick(0.0) {
+        PIPELINE_REQUIRES(Particle_lacks_Position);
+        PIPELINE_REQUIRES(Particle_lacks_PreviousPosition);
+    }
+    inline void Update(float dt) {
+        Base::Update(dt);
+        if (dt > 0.0) tick = dt;
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        // once per tick, sub-steps got the force in BeginSubSteps
+        if (dt >= tick) force.Process(dt, particle);
+        return true;
+    }
+    inline void BeginSubSteps(float dt, unsigned int steps, Particle& particle) {
+        Base::BeginSubSteps(dt, steps, particle);
+        force.Process(dt, particle);
+    }
+};
+
+template <class Base>
+class TurbulenceStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    VectorFieldModifier<Particle> turbulence;
+
+    TurbulenceStage() {
+        PIPELINE_REQUIRES(Particle_lacks_Position);
+        PIPELINE_REQUIRES(Particle_lacks_PreviousPosition);
+    }
+    inline void Update(float dt) {
+        Base::Update(dt);
+        turbulence.Update(dt);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        turbulence.Process(dt, particle);
+        return true;
+    }
+};
+
+template <class Base>
+class CollisionStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    CollisionModifier<Particle> collision;
+
+    CollisionStage() {
+        PIPELINE_REQUIRES(Particle_lacks_Position);
+        PIPELINE_REQUIRES(Particle_lacks_PreviousPosition);
+        PIPELINE_REQUIRES(Particle_lacks_Life);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        return collision.Process(particle);
+    }
+};
+
+template <class Base>
+class SizeStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    SizeModifier<Particle> size;
+
+    SizeStage() : size(1.0) {
+        PIPELINE_REQUIRES(Particle_lacks_Size);
+        PIPELINE_REQUIRES(Particle_lacks_Life);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        size.Process(particle);
+        return true;
+    }
+};
+
+template <class Base>
+class ColorStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    LinearColorModifier<Particle> color;
+
+    ColorStage() {
+        PIPELINE_REQUIRES(Particle_lacks_Color);
+        PIPELINE_REQUIRES(Particle_lacks_Life);
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        color.Process(particle);
+        return true;
+    }
+};
+
+template <class Base>
+class RotationStage : public Base {
+public:
+    typedef typename Base::Particle Particle;
+    TextureRotationModifier<Particle> rotation;
+
+private:
+    float tick;
+
+public:
+    RotationStage() : tick(0.0) {
+        PIPELINE_REQUIRES(Particle_lacks_Rotation);
+    }
+    inline void Update(float dt) {
+        Base::Update(dt);
+        if (dt > 0.0) tick = dt;
+    }
+    inline bool Process(float dt, Particle& particle) {
+        if (!Base::Process(dt, particle)) return false;
+        // the spin is per tick, sub-steps got it in BeginSubSteps
+        if (dt >= tick) rotation.Process(particle);
+        return true;
+    }
+    inline void BeginSubSteps(float dt, unsigned int steps, Particle& particle) {
+        Base::BeginSubSteps(dt, steps, particle);
+        rotation.Process(particle);
+    }
+};
+
+#undef PIPELINE_REQUIRES
+
+/**
+ * Outermost stage, ages the particles and runs the fused loop.
+ *
+ * Process() returns false when the particle has died, which makes a
+ * fused pipeline usable as the modifier chain of an EmitterGroup. The
+ * group calls Update(dt) once per tick.
+ *
+ * With SetAdaptive() a particle whose Travel() in a tick is longer
+ * than maxStep runs the stages in up to maxSubSteps steps of dt/n, so
+ * fast particles do not tunnel through colliders and the integration
+ * stays stable. Only the TimeCorrectedVerletStage reports a travel.
+ */
+template <class Stages>
+class Fused : public Stages {
+public:
+    typedef typename Stages::Particle Particle;
+    LifespanModifier<Particle> lifespan;
+
+private:
+    std::vector<char> alive;
+    float maxStep;
+    unsigned int maxSubSteps;
+
+    inline bool Step(float dt, Particle& particle) {
+        unsigned int steps = 1;
+        if (maxStep > 0.0 && dt > 0.0) {
+            float travel = Stages::Travel(particle);
+            if (travel > maxStep)
+                steps = std::min(maxSubSteps, (unsigned int)std::ceil(travel / maxStep));
+        }
+        if (steps == 1)
+            return Stages::Process(dt, particle);
+
+        const float h = dt / steps;
+        Stages::BeginSubSteps(dt, steps, particle);
+        for (unsigned int i = 0; i < steps; i++)
+            if (!Stages::Process(h, particle)) return false;
+        Stages::EndSubSteps(dt, steps, particle);
+        return true;
+    }
+
+public:
+    Fused() : maxStep(0.0), maxSubSteps(1) {
+        void (*f)(Particle&) = &Particle_lacks_Life<Particle>; (void)f;
+    }
+
+    /**
+     * Enable sub-stepping.
+     *
+     * @param maxStep longest distance a particle may move per sub-step
+     * @param maxSubSteps upper bound on sub-steps per tick
+     */
+    void SetAdaptive(float maxStep, unsigned int maxSubSteps = 8) {
+        if (maxSubSteps == 0)
+            throw Exception("Fused: needs at least one step per tick.");
+        this->maxStep = maxStep;
+        this->maxSubSteps = maxSubSteps;
+    }
+
+    void DisableAdaptive() {
+        maxStep = 0.0;
+        maxSubSteps = 1;
+    }
+
+    inline bool Process(float dt, Particle& particle) {
+        if (!Step(dt, particle)) return false;
+        particle.life += dt;
+        return particle.life < particle.maxlife;
+    }
+
+    /**
+     * One pass over a particle collection. Dead particles are removed
+     * by the LifespanModifier as in the hand written loops.
+     */
+    void Process(float dt, ParticleCollection<Particle>& particles) {
+        Stages::Update(dt);
+        for (particles.iterator.Reset();
+             particles.iterator.HasNext();
+             particles.iterator.Next()) {
+            Step(dt, particles.iterator.Element());
+            lifespan.Process(dt, particles.iterator);
+        }
+    }
+
+    /**
+     * One pass over a contiguous chunk of count particles, split over
+     * the cores when built with OpenMP. Dead particles are compacted
+     * out afterwards and count is updated.
+     */
+    void ProcessChunk(float dt, Particle* particles, unsigned int& count) {
+        Stages::Update(dt);
+        const int n = count;
+        alive.resize(n);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            alive[i] = Process(dt, particles[i]);
+
+        unsigned int live = 0;
+        for (int i = 0; i < n; i++)
+            if (alive[i]) {
+                if (int(live) != i) particles[live] = particles[i];
+                live++;
+            }
+        count = live;
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+// shared memory particle streaming between processes
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include "ParticleStream.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::SharedMemory(std::string name, unsigned int size, bool create)
+    : name(name), size(size), data(NULL), owner(create) {
+#ifdef _WIN32
+    if (create)
+        handle = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                   0, size, name.c_str());
+    else
+        handle = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (handle == NULL)
+        throw Exception("SharedMemory: could not open " + name);
+    data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, create ? size : 0);
+    if (data == NULL) {
+        CloseHandle(handle);
+        throw Exception("SharedMemory: could not map " + name);
+    }
+    if (!create) {
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(data, &info, sizeof(info));
+        this->size = info.RegionSize;
+    }
+#else
+    std::string path = "/" + name;
+    if (create) {
+        // a stale region from a crashed producer is replaced
+        shm_unlink(path.c_str());
+        fd = shm_open(path.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, size) != 0)
+            throw Exception("SharedMemory: could not create " + name);
+    }
+    else {
+        fd = shm_open(path.c_str(), O_RDONLY, 0);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+            throw Exception("SharedMemory: could not open " + name);
+        this->size = st.st_size;
+    }
+    data = mmap(NULL, this->size,
+                create ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        throw Exception("SharedMemory: could not map " + name);
+    }
+#endif
+}
+
+SharedMemory::~SharedMemory() {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(handle);
+#else
+    munmap(data, size);
+    close(fd);
+    if (owner)
+        shm_unlink(("/" + name).c_str());
+#endif
+}
+
+ParticleStreamReader::ParticleStreamReader(std::string name)
+    : memory(name, 0, false), last(0) {
+    header = static_cast<const ParticleStreamHeader*>(memory.GetData());
+    if (memory.GetSize() < sizeof(ParticleStreamHeader) ||
+        header->magic != ParticleStreamHeader::MAGIC ||
+        header->version != ParticleStreamHeader::VERSION)
+        throw Exception("ParticleStreamReader: " + name + " is not a particle stream.");
+    StreamBarrier();
+    // the layout is read once, shared memory is not trusted afterwards
+    slots = header->slots;
+    capacity = header->capacity;
+    unsigned long long bytes = sizeof(ParticleStreamSlot)
+        + (unsigned long long)capacity * sizeof(ParticleRecord);
+    if (slots < 2 ||
+        slots > (memory.GetSize() - sizeof(ParticleStreamHeader)) / bytes)
+        throw Exception("ParticleStreamReader: " + name + " has a broken header.");
+    slotSize = bytes;
+}
+
+const ParticleStreamSlot* ParticleStreamReader::Acquire() {
+    unsigned int published = header->published;
+    StreamBarrier();
+    if (published == 0 || published == last)
+        return NULL;
+    unsigned int frame = published - 1;
+    const char* base = reinterpret_cast<const char*>(header + 1);
+    const ParticleStreamSlot* slot = reinterpret_cast<const ParticleStreamSlot*>
+        (base + (frame % slots) * slotSize);
+    if (slot->sequence != 2*(frame + 1))
+        return NULL;
+    StreamBarrier();
+    last = published;
+    return slot;
+}
+
+bool ParticleStreamReader::Release(const ParticleStreamSlot* slot) {
+    StreamBarrier();
+    // the frame number in the slot may already be overwritten, compare
+    // against the sequence the frame was acquired with
+    return slot->sequence == 2*last;
+}
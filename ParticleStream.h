@@ -0,0 +1,254 @@
+// shared memory particle streaming between processes
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_PARTICLE_STREAM_H_
+#define _OESIM_PARTICLE_STREAM_H_
+
+#include <ParticleSystem/ParticleSystem.h>
+#include <ParticleSystem/ParticleCollection.h>
+#include <Core/IListener.h>
+#include <Core/Exceptions.h>
+
+#include <string>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::Exception;
+using OpenEngine::ParticleSystem::ParticleEventArg;
+using OpenEngine::ParticleSystem::ParticleCollection;
+
+/**
+ * Full memory barrier, orders the stream data against the sequence
+ * numbers between processes.
+ */
+inline void StreamBarrier() {
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+/**
+ * One particle as published in the stream.
+ */
+struct ParticleRecord {
+    float position[3];
+    float color[4];
+    float size;
+    float life;         // life / maxlife in [0,1]
+    float pad[3];
+};
+
+/**
+ * A published tick. The records follow the slot in memory.
+ *
+ * sequence works as a sequence lock: it is odd while the producer
+ * writes the slot and 2*(frame+1) once the frame is complete.
+ */
+struct ParticleStreamSlot {
+    volatile unsigned int sequence;
+    unsigned int frame;
+    unsigned int count;
+    float dt;
+
+    const ParticleRecord* GetRecords() const {
+        return reinterpret_cast<const ParticleRecord*>(this + 1);
+    }
+    ParticleRecord* GetRecords() {
+        return reinterpret_cast<ParticleRecord*>(this + 1);
+    }
+};
+
+struct ParticleStreamHeader {
+    enum { MAGIC = 0x4f455053, VERSION = 1 };  // "OEPS"
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slots;
+    unsigned int capacity;
+    volatile unsigned int published;   // frames published so far
+};
+
+/**
+ * A named shared memory region.
+ */
+class SharedMemory {
+private:
+    std::string name;
+    unsigned int size;
+    void* data;
+    bool owner;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+public:
+    /**
+     * Create (owner) or open an existing region. Size is ignored
+     * when opening, the region size is used.
+     */
+    SharedMemory(std::string name, unsigned int size, bool create);
+    ~SharedMemory();
+
+    void* GetData() { return data; }
+    unsigned int GetSize() { return size; }
+};
+
+/**
+ * Producer side of the particle stream.
+ *
+ * Attach after the effect on ParticleSystem::ProcessEvent and every
+ * tick the particles are copied into the next slot of a ring in
+ * shared memory. The producer never waits for consumers, so a
+ * headless simulation keeps running while viewers come and go.
+ * HeadlessEmitter publishes with it and ParticleStreamNode draws a
+ * stream in another process.
+ */
+template <class T>
+class ParticleStreamWriter : public IListener<ParticleEventArg> {
+private:
+    SharedMemory memory;
+    ParticleStreamHeader* header;
+    ParticleCollection<T>* particles;
+    unsigned int slotSize;
+    unsigned int frame;
+
+    ParticleStreamSlot* Slot(unsigned int n) {
+        char* base = reinterpret_cast<char*>(header + 1);
+        return reinterpret_cast<ParticleStreamSlot*>(base + (n % header->slots) * slotSize);
+    }
+
+    inline void Write(ParticleRecord& r, const T& p) {
+        for (unsigned int k = 0; k < 3; k++)
+            r.position[k] = p.position[k];
+        for (unsigned int k = 0; k < 4; k++)
+            r.color[k] = p.color[k];
+        r.size = p.size;
+        r.life = p.maxlife > 0.0 ? p.life / p.maxlife : 0.0;
+    }
+
+    ParticleStreamSlot* Begin(float dt) {
+        ParticleStreamSlot* slot = Slot(frame);
+        slot->sequence = 2*frame + 1;
+        StreamBarrier();
+        slot->frame = frame;
+        slot->dt = dt;
+        return slot;
+    }
+
+    void End(ParticleStreamSlot* slot) {
+        StreamBarrier();
+        slot->sequence = 2*(frame + 1);
+        StreamBarrier();
+        header->published = ++frame;
+    }
+
+public:
+    /**
+     * @param name name of the shared memory region
+     * @param capacity max particles per frame
+     * @param slots frames in the ring, a consumer must be done with a
+     *              frame before slots-1 newer frames are published
+     */
+    ParticleStreamWriter(std::string name, unsigned int capacity,
+                         unsigned int slots = 4,
+                         ParticleCollection<T>* particles = NULL)
+        : memory(name, sizeof(ParticleStreamHeader)
+                 + slots * (sizeof(ParticleStreamSlot) + capacity * sizeof(ParticleRecord)),
+                 true),
+          particles(particles),
+          slotSize(sizeof(ParticleStreamSlot) + capacity * sizeof(ParticleRecord)),
+          frame(0) {
+        if (slots < 2)
+            throw Exception("ParticleStreamWriter: needs at least two slots.");
+        header = static_cast<ParticleStreamHeader*>(memory.GetData());
+        header->slots = slots;
+        header->capacity = capacity;
+        header->published = 0;
+        for (unsigned int i = 0; i < slots; i++)
+            Slot(i)->sequence = 0;
+        header->version = ParticleStreamHeader::VERSION;
+        StreamBarrier();
+        header->magic = ParticleStreamHeader::MAGIC;
+    }
+
+    /**
+     * Publish a contiguous array of particles, e.g. the slice of an
+     * EmitterGroup emitter.
+     */
+    void Publish(float dt, const T* data, unsigned int count) {
+        ParticleStreamSlot* slot = Begin(dt);
+        count = std::min(count, header->capacity);
+        ParticleRecord* r = slot->GetRecords();
+        for (unsigned int i = 0; i < count; i++)
+            Write(r[i], data[i]);
+        slot->count = count;
+        End(slot);
+    }
+
+    void Publish(float dt, ParticleCollection<T>& collection) {
+        ParticleStreamSlot* slot = Begin(dt);
+        ParticleRecord* r = slot->GetRecords();
+        unsigned int count = 0;
+        for (collection.iterator.Reset();
+             collection.iterator.HasNext() && count < header->capacity;
+             collection.iterator.Next())
+            Write(r[count++], collection.iterator.Element());
+        slot->count = count;
+        End(slot);
+    }
+
+    void Handle(ParticleEventArg e) {
+        if (particles) Publish(e.dt, *particles);
+    }
+};
+
+/**
+ * Consumer side of the particle stream.
+ *
+ * Acquire() gives the newest complete frame directly in shared memory
+ * without copying. The producer does not wait for the consumer, so
+ * call Release() when done: it returns false if the frame was
+ * overwritten while it was read, in which case the data must be
+ * discarded.
+ */
+class ParticleStreamReader {
+private:
+    SharedMemory memory;
+    const ParticleStreamHeader* header;
+    unsigned int slots, capacity;
+    unsigned int slotSize;
+    unsigned int last;
+
+public:
+    /**
+     * Open a stream. Throws if the region is not a particle stream or
+     * its header does not fit the region.
+     */
+    ParticleStreamReader(std::string name);
+
+    /**
+     * @return the newest frame not seen before, or NULL.
+     */
+    const ParticleStreamSlot* Acquire();
+
+    /**
+     * @return true if the frame was intact while it was read.
+     */
+    bool Release(const ParticleStreamSlot* slot);
+
+    unsigned int GetCapacity() { return capacity; }
+};
+
+#endif
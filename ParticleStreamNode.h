@@ -0,0 +1,160 @@
+// render node drawing a particle stream published by another process
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_PARTICLE_STREAM_NODE_H_
+#define _OESIM_PARTICLE_STREAM_NODE_H_
+
+#include <Renderers/IRenderNode.h>
+#include <Renderers/IRenderingView.h>
+#include <Resources/ITexture2D.h>
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+#include <Meta/OpenGL.h>
+
+#include "ParticleStream.h"
+
+#include <string>
+#include <algorithm>
+
+using OpenEngine::Renderers::IRenderNode;
+using OpenEngine::Renderers::IRenderingView;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+
+/**
+ * Consumer of a particle stream, draws the newest published frame as
+ * camera facing quads straight from shared memory.
+ *
+ * The stream is opened on the first frame it exists, so the viewer
+ * can be started before the simulation and restarted at any time
+ * without disturbing it. When no new frame has been published the
+ * last one is drawn again for as long as it has not been overwritten.
+ * A frame overwritten while it was drawn shows for one frame and is
+ * counted in GetTorn(). After a number of frames without anything new
+ * the stream is opened again, which picks up a restarted producer.
+ *
+ * The texture must be uploaded already, set it with SetTexture() when
+ * the AsyncTextureLoader reports it loaded.
+ */
+class ParticleStreamNode : public IRenderNode {
+private:
+    std::string name;
+    ParticleStreamReader* reader;
+    const ParticleStreamSlot* current;
+    ITexture2DPtr texture;
+    unsigned int torn;
+    unsigned int idle, reopen;
+
+public:
+    /**
+     * @param reopen frames without a new stream frame before the
+     *               stream is opened again
+     */
+    ParticleStreamNode(std::string name, unsigned int reopen = 120)
+        : name(name), reader(NULL), current(NULL),
+          torn(0), idle(0), reopen(reopen) {}
+
+    virtual ~ParticleStreamNode() {
+        delete reader;
+    }
+
+    void SetTexture(ITexture2DPtr texture) {
+        this->texture = texture;
+    }
+
+    unsigned int GetTorn() {
+        return torn;
+    }
+
+    void Apply(IRenderingView* view) {
+        if (reader && idle >= reopen) {
+            // the producer may have restarted into a new region
+            delete reader;
+            reader = NULL;
+            current = NULL;
+        }
+        if (reader == NULL) {
+            idle = 0;
+            try {
+                reader = new ParticleStreamReader(name);
+            }
+            catch (Exception) {
+                // no producer yet, try again next frame
+            }
+        }
+        if (reader) {
+            const ParticleStreamSlot* slot = reader->Acquire();
+            if (slot) {
+                current = slot;
+                idle = 0;
+            }
+            else idle++;
+        }
+        if (current) {
+            Draw(current);
+            if (!reader->Release(current)) {
+                current = NULL;
+                torn++;
+            }
+        }
+        VisitSubNodes(*view);
+    }
+
+private:
+    void Draw(const ParticleStreamSlot* slot) {
+        glPushAttrib(GL_LIGHTING);
+        glDisable(GL_LIGHTING);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        if (texture) {
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, texture->GetID());
+        }
+
+        // billboard axes are the camera right and up vectors
+        float modelview[16];
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        Vector<3,float> right(modelview[0], modelview[4], modelview[8]);
+        Vector<3,float> up(modelview[1], modelview[5], modelview[9]);
+
+        const ParticleRecord* r = slot->GetRecords();
+        const unsigned int count = std::min(slot->count, reader->GetCapacity());
+        glBegin(GL_QUADS);
+        for (unsigned int i = 0; i < count; i++) {
+            Vector<3,float> p(r[i].position[0], r[i].position[1], r[i].position[2]);
+            Vector<3,float> a = right * r[i].size;
+            Vector<3,float> b = up * r[i].size;
+            glColor4fv(r[i].color);
+
+            Vector<3,float> v;
+            v = p - a - b;
+            glTexCoord2f(0.0, 0.0);
+            glVertex3f(v[0], v[1], v[2]);
+            v = p - a + b;
+            glTexCoord2f(0.0, 1.0);
+            glVertex3f(v[0], v[1], v[2]);
+            v = p + a + b;
+            glTexCoord2f(1.0, 1.0);
+            glVertex3f(v[0], v[1], v[2]);
+            v = p + a - b;
+            glTexCoord2f(1.0, 0.0);
+            glVertex3f(v[0], v[1], v[2]);
+        }
+        glEnd();
+
+        if (texture) glDisable(GL_TEXTURE_2D);
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+        glPopAttrib();
+    }
+};
+
+#endif
@@ -0,0 +1,53 @@
+// counting semaphore for worker threads
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include "Signal.h"
+
+#ifdef _WIN32
+Signal::Signal() {
+    semaphore = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+}
+
+Signal::~Signal() {
+    CloseHandle(semaphore);
+}
+
+void Signal::Post(unsigned int n) {
+    ReleaseSemaphore(semaphore, n, NULL);
+}
+
+void Signal::Wait() {
+    WaitForSingleObject(semaphore, INFINITE);
+}
+#else
+Signal::Signal() : count(0) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+Signal::~Signal() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+void Signal::Post(unsigned int n) {
+    pthread_mutex_lock(&mutex);
+    count += n;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+void Signal::Wait() {
+    pthread_mutex_lock(&mutex);
+    while (count == 0)
+        pthread_cond_wait(&cond, &mutex);
+    count--;
+    pthread_mutex_unlock(&mutex);
+}
+#endif
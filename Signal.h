@@ -0,0 +1,39 @@
+// counting semaphore for worker threads
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_SIGNAL_H_
+#define _OESIM_SIGNAL_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * Counting semaphore idle worker threads block on. Every Post() lets
+ * one Wait() return.
+ */
+class Signal {
+private:
+#ifdef _WIN32
+    HANDLE semaphore;
+#else
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int count;
+#endif
+public:
+    Signal();
+    ~Signal();
+    void Post(unsigned int n = 1);
+    void Wait();
+};
+
+#endif
@@ -0,0 +1,287 @@
+// texture atlas for multi-texture emitters
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_TEXTURE_ATLAS_H_
+#define _OESIM_TEXTURE_ATLAS_H_
+
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+#include <Math/RandomGenerator.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/Texture2D.h>
+#include <Resources/Types/ResourceTypes.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+using OpenEngine::Math::RandomGenerator;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Resources::ColorFormat;
+using OpenEngine::Resources::UCharTexture2D;
+using OpenEngine::Resources::UCharTexture2DPtr;
+
+/**
+ * Particle attribute selecting a frame of a TextureAtlas.
+ *
+ * Replaces the Texture attribute for emitters that draw from an
+ * atlas: the particle stores a small frame index instead of a
+ * reference counted texture pointer. rotation and spin are kept so
+ * the TextureRotationModifier works unchanged.
+ */
+template <class T>
+class AtlasFrame : public T {
+public:
+    unsigned short frame;
+    float rotation, spin;
+};
+
+/**
+ * Packs a number of textures, or the frames of sprite sheets, into one
+ * texture at load time, so an emitter with several textures is drawn
+ * with a single bind.
+ *
+ * Add the images, call Build() and look up frames with GetFrame(),
+ * which gives the texture coordinates (u0, v0, u1, v1) of the frame
+ * in the atlas. All images must be 8 bit per channel and have the same
+ * colour format. Sprite sheets are cut into their frames, which are
+ * packed as separate images. The border texels of each packed image
+ * are repeated into the padding around it, so linear filtering and
+ * mipmapping do not bleed neighbouring images or frames into it.
+ *
+ * At most 65536 frames fit, as AtlasFrame stores an unsigned short.
+ */
+class TextureAtlas {
+private:
+    struct Image {
+        ITexture2DPtr texture;
+        unsigned int cols, rows;
+        unsigned int firstFrame;
+    };
+
+    // one frame of an image, the unit of packing
+    struct Cell {
+        const Image* image;
+        unsigned int col, row;
+        unsigned int width, height;
+        unsigned int x, y;
+    };
+
+    static const unsigned int MAX_FRAMES = 65536;
+
+    std::vector<Image> images;
+    std::vector<Vector<4,float> > frames;
+    UCharTexture2DPtr atlas;
+    unsigned int padding;
+
+    static unsigned int NextPowerOfTwo(unsigned int n) {
+        unsigned int p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    static bool TallerFirst(const Cell* a, const Cell* b) {
+        return a->height > b->height;
+    }
+
+public:
+    TextureAtlas(unsigned int padding = 1) : padding(padding) {}
+
+    /**
+     * Add a single texture.
+     * @return frame index of the texture
+     */
+    unsigned int AddTexture(ITexture2DPtr texture) {
+        return AddSpriteSheet(texture, 1, 1);
+    }
+
+    /**
+     * Add a sprite sheet of cols x rows equally sized frames, in row
+     * major order from the first texture row.
+     * @return frame index of the first frame of the sheet
+     */
+    unsigned int AddSpriteSheet(ITexture2DPtr texture,
+                                unsigned int cols, unsigned int rows) {
+        if (atlas)
+            throw Exception("TextureAtlas: cannot add images after Build().");
+        if (cols == 0 || rows == 0)
+            throw Exception("TextureAtlas: empty sprite sheet.");
+        Image img;
+        img.texture = texture;
+        img.cols = cols;
+        img.rows = rows;
+        img.firstFrame = images.empty() ? 0
+            : images.back().firstFrame + images.back().cols * images.back().rows;
+        if (cols > MAX_FRAMES || rows > MAX_FRAMES / cols
+            || img.firstFrame + cols * rows > MAX_FRAMES)
+            throw Exception("TextureAtlas: more than 65536 frames.");
+        images.push_back(img);
+        return img.firstFrame;
+    }
+
+    /**
+     * Decode the images and pack them into the atlas texture.
+     * The source images are unloaded afterwards.
+     */
+    void Build() {
+        if (images.empty())
+            throw Exception("TextureAtlas: no images.");
+
+        unsigned int channels = 0, area = 0, widest = 0;
+        ColorFormat format = images[0].texture->GetColorFormat();
+        std::vector<Cell> cells;
+        for (unsigned int i = 0; i < images.size(); i++) {
+            const Image& img = images[i];
+            ITexture2DPtr tex = img.texture;
+            tex->Load();
+            if (tex->GetType() != OpenEngine::Types::UBYTE)
+                throw Exception("TextureAtlas: images must have 8 bit channels.");
+            if (i == 0) {
+                channels = tex->GetChannels();
+                format = tex->GetColorFormat();
+            }
+            if (tex->GetChannels() != channels || tex->GetColorFormat() != format)
+                throw Exception("TextureAtlas: images differ in colour format.");
+            if (tex->GetWidth() % img.cols != 0 || tex->GetHeight() % img.rows != 0)
+                throw Exception("TextureAtlas: sprite sheet does not divide into its frames.");
+
+            // cells in frame order, row major
+            Cell cell;
+            cell.image = &img;
+            cell.width = tex->GetWidth() / img.cols;
+            cell.height = tex->GetHeight() / img.rows;
+            cell.x = cell.y = 0;
+            for (cell.row = 0; cell.row < img.rows; cell.row++)
+                for (cell.col = 0; cell.col < img.cols; cell.col++)
+                    cells.push_back(cell);
+            unsigned int w = cell.width + 2*padding;
+            unsigned int h = cell.height + 2*padding;
+            area += w * h * img.cols * img.rows;
+            widest = std::max(widest, w);
+        }
+
+        // shelf packing, tallest cells first
+        std::vector<Cell*> order;
+        for (unsigned int i = 0; i < cells.size(); i++)
+            order.push_back(&cells[i]);
+        std::stable_sort(order.begin(), order.end(), TallerFirst);
+
+        unsigned int width = NextPowerOfTwo(std::max(widest, unsigned(std::sqrt(float(area)))));
+        unsigned int x = 0, y = 0, shelf = 0;
+        for (unsigned int i = 0; i < order.size(); i++) {
+            unsigned int w = order[i]->width + 2*padding;
+            unsigned int h = order[i]->height + 2*padding;
+            if (x + w > width) {
+                x = 0;
+                y += shelf;
+                shelf = 0;
+            }
+            order[i]->x = x + padding;
+            order[i]->y = y + padding;
+            x += w;
+            shelf = std::max(shelf, h);
+        }
+        unsigned int height = NextPowerOfTwo(y + shelf);
+
+        atlas = UCharTexture2DPtr(new UCharTexture2D(width, height, channels));
+        atlas->SetColorFormat(format);
+        unsigned char* dst = atlas->GetData();
+        std::memset(dst, 0, width * height * channels);
+
+        frames.clear();
+        for (unsigned int i = 0; i < cells.size(); i++) {
+            const Cell& cell = cells[i];
+            const unsigned int sw = cell.image->texture->GetWidth();
+            const unsigned int w = cell.width, h = cell.height;
+            const unsigned char* src =
+                (const unsigned char*)cell.image->texture->GetVoidDataPtr()
+                + (cell.row * h * sw + cell.col * w) * channels;
+            // rows of the padding repeat the first and last cell row,
+            // columns of the padding the first and last texel of a row
+            const int p = padding;
+            for (int row = -p; row < int(h) + p; row++) {
+                int sr = std::min(std::max(row, 0), int(h) - 1);
+                const unsigned char* in = src + sr * sw * channels;
+                unsigned char* out = dst + ((cell.y + row) * width + cell.x) * channels;
+                std::memcpy(out, in, w * channels);
+                for (int k = 1; k <= p; k++) {
+                    std::memcpy(out - k * channels, in, channels);
+                    std::memcpy(out + (w - 1 + k) * channels, in + (w - 1) * channels, channels);
+                }
+            }
+            frames.push_back(Vector<4,float>(float(cell.x) / width,
+                                             float(cell.y) / height,
+                                             float(cell.x + w) / width,
+                                             float(cell.y + h) / height));
+        }
+        for (unsigned int i = 0; i < images.size(); i++)
+            images[i].texture->Unload();
+    }
+
+    ITexture2DPtr GetTexture() {
+        return atlas;
+    }
+
+    unsigned int GetNumFrames() {
+        return frames.size();
+    }
+
+    const Vector<4,float>& GetFrame(unsigned int frame) const {
+        return frames[frame];
+    }
+};
+
+/**
+ * Assigns a random frame from a range of atlas frames.
+ */
+template <class T>
+class RandomFrameInitializer {
+private:
+    unsigned int first, count;
+    RandomGenerator random;
+public:
+    RandomFrameInitializer(unsigned int first = 0, unsigned int count = 1)
+        : first(first), count(count) {
+        random.SeedWithTime();
+    }
+
+    void SetFrames(unsigned int first, unsigned int count) {
+        this->first = first;
+        this->count = count;
+    }
+
+    inline void Process(T& particle) {
+        unsigned int offset = (unsigned int)(random.UniformFloat(0.0, 1.0) * count);
+        particle.frame = first + std::min(offset, count - 1);
+    }
+};
+
+/**
+ * Plays a range of atlas frames over the life of the particle, for
+ * animated sprite sheets.
+ */
+template <class T>
+class AtlasAnimationModifier {
+private:
+    unsigned int first, count;
+public:
+    AtlasAnimationModifier(unsigned int first, unsigned int count)
+        : first(first), count(count) {}
+
+    inline void Process(T& particle) {
+        float t = particle.maxlife > 0.0 ? particle.life / particle.maxlife : 0.0;
+        unsigned int offset = (unsigned int)(t * count);
+        particle.frame = first + std::min(offset, count - 1);
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+// time corrected verlet integration
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_TIME_CORRECTED_VERLET_MODIFIER_H_
+#define _OESIM_TIME_CORRECTED_VERLET_MODIFIER_H_
+
+#include <Math/Vector.h>
+
+#include <cmath>
+#include <algorithm>
+
+using OpenEngine::Math::Vector;
+
+/**
+ * Verlet integration that stays correct when dt varies.
+ *
+ * Plain Verlet takes position - previousPosition as the motion of the
+ * coming step, which is only right if the step is as long as the
+ * previous one. Here the motion is scaled by dt / previous dt:
+ *
+ *   x' = x + (x - xp) * dt/dtp + a * dt^2
+ *
+ * so position - previousPosition always holds the motion over the
+ * last tick and a variable ParticleSystemTimer does not change the
+ * particle speeds.
+ *
+ * A Fused pipeline with SetAdaptive() may split a tick into sub-steps
+ * for fast particles. BeginSubSteps() turns the motion of the tick into
+ * the motion of one sub-step, steps shorter than the tick are then
+ * taken as plain Verlet steps, and EndSubSteps() scales the motion back
+ * to the whole tick. For a constant acceleration the result is the
+ * same as a single step, only collisions see the shorter moves.
+ *
+ * Call Update(dt) once per tick before processing the particles.
+ */
+template <class T>
+class TimeCorrectedVerletModifier {
+private:
+    Vector<3,float> acceleration;
+    float dt, prevDt, ratio;
+
+    static inline float Length(const Vector<3,float>& v) {
+        return std::sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    }
+
+public:
+    TimeCorrectedVerletModifier(Vector<3,float> acceleration = Vector<3,float>())
+        : acceleration(acceleration), dt(0.0), prevDt(0.0), ratio(1.0) {}
+
+    void SetAcceleration(Vector<3,float> acceleration) {
+        this->acceleration = acceleration;
+    }
+
+    /**
+     * Start a tick of length dt. An empty tick (paused timer) is
+     * ignored, so the next one is still scaled against the last real
+     * step.
+     */
+    void Update(float dt) {
+        if (dt <= 0.0) return;
+        prevDt = this->dt;
+        this->dt = dt;
+        ratio = (prevDt > 0.0) ? dt / prevDt : 1.0;
+    }
+
+    /**
+     * Distance the particle moves this tick, from its motion or from
+     * the acceleration alone.
+     */
+    inline float Travel(const T& particle) const {
+        float motion = Length(particle.position - particle.previousPosition) * ratio;
+        return std::max(motion, Length(acceleration) * (dt*dt));
+    }
+
+    inline void Process(float dt, T& particle) {
+        if (dt <= 0.0) return;
+        // a step shorter than the tick is a sub-step, the motion is
+        // already that of a step as long
+        float scale = (dt < this->dt) ? 1.0 : ratio;
+        Vector<3,float> motion = (particle.position - particle.previousPosition) * scale;
+        particle.previousPosition = particle.position;
+        particle.position = particle.position + motion + acceleration * (dt*dt);
+    }
+
+    /**
+     * Scale the motion of the tick dt to the first of steps sub-steps.
+     */
+    inline void BeginSubSteps(float dt, unsigned int steps, T& particle) {
+        float h = dt / steps;
+        Vector<3,float> motion = (particle.position - particle.previousPosition)
+            * (ratio / steps) + acceleration * (h * (dt - h) * 0.5);
+        particle.previousPosition = particle.position - motion;
+    }
+
+    /**
+     * Scale the motion of the last sub-step back to the tick dt.
+     */
+    inline void EndSubSteps(float dt, unsigned int steps, T& particle) {
+        float h = dt / steps;
+        Vector<3,float> motion = (particle.position - particle.previousPosition)
+            * float(steps) - acceleration * (dt * (dt - h) * 0.5);
+        particle.previousPosition = particle.position - motion;
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+// streaming export of particle trajectories
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#include "TrajectoryExporter.h"
+
+#include <Core/Exceptions.h>
+#include <Logging/Logger.h>
+
+#include <zlib.h>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+using OpenEngine::Core::Exception;
+
+TrajectoryWriter::TrajectoryWriter(std::string file, unsigned int attributes,
+                                   unsigned int capacity, unsigned int staging)
+    : attributes(attributes), frames(staging), worker(*this),
+      running(true), dropped(0), written(0) {
+    out = fopen(file.c_str(), "wb");
+    if (out == NULL)
+        throw Exception("TrajectoryWriter: could not open " + file);
+    fwrite("OEPT", 1, 4, out);
+    Write(2u);
+    Write(attributes);
+
+    // reserve up front so the simulation side never allocates
+    for (unsigned int i = 0; i < frames.size(); i++) {
+        for (unsigned int a = 0; a < NUM_ATTRIBUTES; a++)
+            if (attributes & (1 << a))
+                frames[i].columns[a].reserve(capacity * Width(1 << a));
+        free.push_back(&frames[i]);
+    }
+    for (unsigned int a = 0; a < NUM_ATTRIBUTES; a++)
+        if (attributes & (1 << a))
+            compressed[a].reserve(compressBound(capacity * Width(1 << a)
+                                                * sizeof(float)));
+    worker.Start();
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    // the worker drains the queue before it stops
+    running = false;
+    work.Post();
+    worker.Wait();
+    WriteIndex();
+    fclose(out);
+    if (dropped > 0)
+        logger.warning << "TrajectoryWriter: dropped " << dropped
+                       << " frames" << logger.end;
+}
+
+unsigned int TrajectoryWriter::Width(unsigned int attribute) {
+    switch (attribute) {
+    case POSITION: return 3;
+    case COLOR:    return 4;
+    default:       return 1;
+    }
+}
+
+TrajectoryWriter::Frame* TrajectoryWriter::Acquire() {
+    Frame* frame = NULL;
+    lock.Lock();
+    if (!free.empty()) {
+        frame = free.front();
+        free.pop_front();
+    }
+    else dropped++;
+    lock.Unlock();
+    if (frame)
+        for (unsigned int a = 0; a < NUM_ATTRIBUTES; a++)
+            frame->columns[a].clear();
+    return frame;
+}
+
+void TrajectoryWriter::Submit(Frame* frame) {
+    lock.Lock();
+    full.push_back(frame);
+    lock.Unlock();
+    work.Post();
+}
+
+unsigned int TrajectoryWriter::GetDropped() {
+    lock.Lock();
+    unsigned int n = dropped;
+    lock.Unlock();
+    return n;
+}
+
+unsigned int TrajectoryWriter::GetWritten() {
+    lock.Lock();
+    unsigned int n = written;
+    lock.Unlock();
+    return n;
+}
+
+unsigned long long TrajectoryWriter::Tell() {
+#ifdef _WIN32
+    return _ftelli64(out);
+#else
+    return ftello(out);
+#endif
+}
+
+void TrajectoryWriter::Seek(unsigned long long offset) {
+#ifdef _WIN32
+    _fseeki64(out, offset, SEEK_SET);
+#else
+    fseeko(out, offset, SEEK_SET);
+#endif
+}
+
+void TrajectoryWriter::Write(unsigned int value) {
+    unsigned char b[4] = { (unsigned char)(value & 0xff),
+                           (unsigned char)((value >> 8) & 0xff),
+                           (unsigned char)((value >> 16) & 0xff),
+                           (unsigned char)((value >> 24) & 0xff) };
+    fwrite(b, 1, 4, out);
+}
+
+void TrajectoryWriter::Write(unsigned long long value) {
+    Write((unsigned int)(value & 0xffffffff));
+    Write((unsigned int)(value >> 32));
+}
+
+bool TrajectoryWriter::Write(Frame* frame) {
+    // compress every column before writing, so a failure leaves no
+    // partial chunk behind
+    for (unsigned int a = 0; a < NUM_ATTRIBUTES; a++) {
+        if (!(attributes & (1 << a))) continue;
+        const std::vector<float>& column = frame->columns[a];
+        uLong raw = column.size() * sizeof(float);
+        uLongf size = 0;
+        if (raw > 0) {
+            size = compressBound(raw);
+            compressed[a].resize(size);
+            int err = compress2(&compressed[a][0], &size,
+                                reinterpret_cast<const Bytef*>(&column[0]),
+                                raw, Z_BEST_SPEED);
+            if (err != Z_OK) {
+                logger.warning << "TrajectoryWriter: compression of frame "
+                               << frame->frame << " failed (" << err
+                               << "), frame dropped" << logger.end;
+                return false;
+            }
+        }
+        sizes[a] = size;
+    }
+
+    const unsigned long long start = Tell();
+    unsigned int time;
+    std::memcpy(&time, &frame->time, 4);
+    fwrite("FRAM", 1, 4, out);
+    Write(frame->frame);
+    Write(time);
+    Write(frame->count);
+    for (unsigned int a = 0; a < NUM_ATTRIBUTES; a++) {
+        if (!(attributes & (1 << a))) continue;
+        Write((unsigned int)(frame->columns[a].size() * sizeof(float)));
+        Write((unsigned int)sizes[a]);
+        if (sizes[a] > 0)
+            fwrite(&compressed[a][0], 1, sizes[a], out);
+    }
+
+    // flush so a failed write shows up at the chunk that caused it,
+    // then rewind over the partial chunk so the next one replaces it
+    if (fflush(out) != 0 || ferror(out)) {
+        logger.warning << "TrajectoryWriter: writing frame "
+                       << frame->frame << " failed, frame dropped"
+                       << logger.end;
+        clearerr(out);
+        Seek(start);
+        return false;
+    }
+    index.push_back(std::make_pair(frame->frame, start));
+    return true;
+}
+
+void TrajectoryWriter::WriteIndex() {
+    unsigned long long offset = Tell();
+    for (unsigned int i = 0; i < index.size(); i++) {
+        Write(index[i].first);
+        Write(index[i].second);
+    }
+    Write(offset);
+    Write((unsigned int)index.size());
+    fwrite("OEPI", 1, 4, out);
+    if (fflush(out) != 0 || ferror(out))
+        logger.warning << "TrajectoryWriter: writing the index failed"
+                       << logger.end;
+}
+
+void TrajectoryWriter::Worker::Run() {
+    for (;;) {
+        // one post per submitted frame and one to stop
+        writer.work.Wait();
+        Frame* frame = NULL;
+        writer.lock.Lock();
+        if (!writer.full.empty()) {
+            frame = writer.full.front();
+            writer.full.pop_front();
+        }
+        writer.lock.Unlock();
+
+        if (frame == NULL) {
+            if (!writer.running) break;
+            continue;
+        }
+        bool ok = writer.Write(frame);
+
+        writer.lock.Lock();
+        if (ok) writer.written++;
+        else writer.dropped++;
+        writer.free.push_back(frame);
+        writer.lock.Unlock();
+    }
+}
@@ -0,0 +1,180 @@
+// streaming export of particle trajectories
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_TRAJECTORY_EXPORTER_H_
+#define _OESIM_TRAJECTORY_EXPORTER_H_
+
+#include <ParticleSystem/ParticleSystem.h>
+#include <ParticleSystem/ParticleCollection.h>
+#include <Core/IListener.h>
+#include <Core/Thread.h>
+#include <Core/Mutex.h>
+
+#include "Signal.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdio>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::Thread;
+using OpenEngine::Core::Mutex;
+using OpenEngine::ParticleSystem::ParticleEventArg;
+using OpenEngine::ParticleSystem::ParticleCollection;
+
+/**
+ * Writes particle frames to a trajectory file on a background thread.
+ *
+ * File layout, integers little endian, 32 bit unless noted:
+ *   header  "OEPT" version attributes
+ *   chunks  one per frame: "FRAM" frame time count, then for each
+ *           selected attribute its raw and compressed byte size and
+ *           the zlib compressed column
+ *   index   frame and 64 bit file offset of every chunk
+ *   footer  64 bit index offset, number of frames, "OEPI"
+ * so a reader finds any frame through the footer without scanning.
+ *
+ * The simulation side only copies into preallocated staging frames
+ * and never waits: when all staging frames are queued for writing the
+ * frame is dropped and counted. A frame that fails to compress or to
+ * write is logged and dropped as well, the index only lists complete
+ * chunks.
+ */
+class TrajectoryWriter {
+public:
+    enum Attribute {
+        POSITION = 1,  // 3 floats
+        COLOR    = 2,  // 4 floats
+        SIZE     = 4,  // 1 float
+        LIFE     = 8   // 1 float, life / maxlife
+    };
+    static const unsigned int NUM_ATTRIBUTES = 4;
+
+    struct Frame {
+        unsigned int frame;
+        float time;
+        unsigned int count;
+        std::vector<float> columns[NUM_ATTRIBUTES];
+    };
+
+    /**
+     * @param staging number of staging frames, 2 for double buffering
+     * @param capacity particles per frame to preallocate for
+     */
+    TrajectoryWriter(std::string file, unsigned int attributes,
+                     unsigned int capacity, unsigned int staging = 2);
+    ~TrajectoryWriter();
+
+    static unsigned int Width(unsigned int attribute);
+
+    unsigned int GetAttributes() { return attributes; }
+
+    /**
+     * Get an empty staging frame, or NULL if all are in use.
+     */
+    Frame* Acquire();
+
+    /**
+     * Queue a filled staging frame for writing.
+     */
+    void Submit(Frame* frame);
+
+    unsigned int GetDropped();
+    unsigned int GetWritten();
+
+private:
+    class Worker : public Thread {
+    private:
+        TrajectoryWriter& writer;
+    public:
+        Worker(TrajectoryWriter& writer) : writer(writer) {}
+        void Run();
+    };
+
+    FILE* out;
+    unsigned int attributes;
+    std::vector<Frame> frames;
+    std::deque<Frame*> free, full;
+    Mutex lock;
+    Signal work;
+    Worker worker;
+    volatile bool running;
+    unsigned int dropped, written;
+    std::vector<unsigned char> compressed[NUM_ATTRIBUTES];
+    unsigned long sizes[NUM_ATTRIBUTES];
+    std::vector<std::pair<unsigned int, unsigned long long> > index;
+
+    unsigned long long Tell();
+    void Seek(unsigned long long offset);
+    void Write(unsigned int value);
+    void Write(unsigned long long value);
+    bool Write(Frame* frame);
+    void WriteIndex();
+};
+
+/**
+ * Exports the particles of a collection every tick.
+ *
+ * Attach after the effect on ParticleSystem::ProcessEvent.
+ */
+template <class T>
+class TrajectoryExporter : public IListener<ParticleEventArg> {
+private:
+    TrajectoryWriter writer;
+    ParticleCollection<T>& particles;
+    unsigned int frame;
+    float time;
+
+public:
+    TrajectoryExporter(std::string file, ParticleCollection<T>& particles,
+                       unsigned int attributes = TrajectoryWriter::POSITION
+                       | TrajectoryWriter::COLOR
+                       | TrajectoryWriter::SIZE
+                       | TrajectoryWriter::LIFE)
+        : writer(file, attributes, particles.GetSize()),
+          particles(particles), frame(0), time(0.0) {}
+
+    TrajectoryWriter& GetWriter() { return writer; }
+
+    void Handle(ParticleEventArg e) {
+        time += e.dt;
+        TrajectoryWriter::Frame* f = writer.Acquire();
+        if (f == NULL) {
+            frame++;
+            return;
+        }
+        f->frame = frame++;
+        f->time = time;
+
+        const unsigned int attr = writer.GetAttributes();
+        std::vector<float>* c = f->columns;
+        unsigned int count = 0;
+        for (particles.iterator.Reset();
+             particles.iterator.HasNext();
+             particles.iterator.Next()) {
+            T& p = particles.iterator.Element();
+            if (attr & TrajectoryWriter::POSITION)
+                for (unsigned int k = 0; k < 3; k++)
+                    c[0].push_back(p.position[k]);
+            if (attr & TrajectoryWriter::COLOR)
+                for (unsigned int k = 0; k < 4; k++)
+                    c[1].push_back(p.color[k]);
+            if (attr & TrajectoryWriter::SIZE)
+                c[2].push_back(p.size);
+            if (attr & TrajectoryWriter::LIFE)
+                c[3].push_back(p.maxlife > 0.0 ? p.life / p.maxlife : 0.0);
+            count++;
+        }
+        f->count = count;
+        writer.Submit(f);
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+// force from a precomputed 3d vector field
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS)
+//
+// This program is free software; It is covered by the GNU General
+// Public License version 2 or any later version.
+// See the GNU General Public License for more details (see LICENSE).
+//--------------------------------------------------------------------
+
+#ifndef _OESIM_VECTOR_FIELD_MODIFIER_H_
+#define _OESIM_VECTOR_FIELD_MODIFIER_H_
+
+#include <Core/Exceptions.h>
+#include <Math/Vector.h>
+#include <Math/RandomGenerator.h>
+#include <Resources/DirectoryManager.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Math::Vector;
+using OpenEngine::Math::RandomGenerator;
+using OpenEngine::Resources::DirectoryManager;
+
+/**
+ * Force sampled from a 3d grid of vectors.
+ *
+ * The grid is either loaded from a file or baked from curl noise at
+ * startup, so the per particle cost is one trilinear lookup no matter
+ * how expensive the field was to compute. The grid tiles space: it is
+ * placed at an origin (typically the emitter position) with a given
+ * cell size and scrolls with a constant velocity over time.
+ *
+ * Call Update(dt) once per tick and Process(dt, particle) for each
+ * particle. The force is added to the Verlet velocity by moving
+ * previousPosition, so run it before the VerletModifier.
+ */
+template <class T>
+class VectorFieldModifier {
+private:
+    unsigned int nx, ny, nz;
+    // xyz and one padding float per node, for four wide loads
+    std::vector<float> field;
+    Vector<3,float> origin, scroll, offset;
+    float invCellSize;
+    float strength;
+    float tick;
+
+    inline unsigned int Index(unsigned int i, unsigned int j, unsigned int k) const {
+        return ((k*ny + j)*nx + i) * 4;
+    }
+
+    static inline int Wrap(int i, int n) {
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    static inline float Smooth(float t) {
+        return t*t*(3.0 - 2.0*t);
+    }
+
+    /**
+     * Periodic value noise at lattice resolution period^3.
+     */
+    static float Noise(const std::vector<float>& lattice, int period,
+                       float x, float y, float z) {
+        int i = int(std::floor(x)), j = int(std::floor(y)), k = int(std::floor(z));
+        float fx = Smooth(x-i), fy = Smooth(y-j), fz = Smooth(z-k);
+        float v = 0.0;
+        for (int c = 0; c < 8; c++) {
+            int di = c & 1, dj = (c >> 1) & 1, dk = (c >> 2) & 1;
+            float w = (di ? fx : 1-fx) * (dj ? fy : 1-fy) * (dk ? fz : 1-fz);
+            v += w * lattice[(Wrap(k+dk,period)*period + Wrap(j+dj,period))*period
+                             + Wrap(i+di,period)];
+        }
+        return v;
+    }
+
+public:
+    VectorFieldModifier(Vector<3,float> origin = Vector<3,float>(),
+                        float cellSize = 1.0,
+                        float strength = 1.0)
+        : nx(0), ny(0), nz(0), origin(origin),
+          invCellSize(1.0/cellSize), strength(strength), tick(0.0) {}
+
+    /**
+     * Load a field from a text file with the grid dimensions
+     * "nx ny nz" followed by nx*ny*nz vectors "x y z", x fastest.
+     */
+    void Load(std::string file) {
+        std::string path = DirectoryManager::FindFileInPath(file);
+        std::ifstream in(path.c_str());
+        if (!in)
+            throw Exception("VectorFieldModifier: could not open " + file);
+        // parse into locals, the current field stays valid on errors
+        unsigned int sx = 0, sy = 0, sz = 0;
+        in >> sx >> sy >> sz;
+        if (!in || sx == 0 || sy == 0 || sz == 0)
+            throw Exception("VectorFieldModifier: bad header in " + file);
+        std::vector<float> values(sx*sy*sz*4, 0.0);
+        for (unsigned int n = 0; n < sx*sy*sz; n++)
+            in >> values[n*4] >> values[n*4+1] >> values[n*4+2];
+        if (!in)
+            throw Exception("VectorFieldModifier: truncated field in " + file);
+        nx = sx; ny = sy; nz = sz;
+        field.swap(values);
+    }
+
+    /**
+     * Bake a divergence free field as the curl of a periodic noise
+     * potential, which gives swirling motion without sinks or
+     * sources.
+     *
+     * @param size grid resolution in each direction
+     * @param features number of noise features across the grid
+     */
+    void BakeCurlNoise(unsigned int size, unsigned int features,
+                       RandomGenerator& random) {
+        if (size == 0)
+            throw Exception("VectorFieldModifier: empty grid.");
+        if (features == 0)
+            throw Exception("VectorFieldModifier: curl noise needs at least one feature.");
+        const int period = features;
+        const float scale = float(features) / size;
+
+        // one noise lattice per potential component
+        std::vector<float> lattice[3];
+        for (unsigned int c = 0; c < 3; c++) {
+            lattice[c].resize(period*period*period);
+            for (unsigned int n = 0; n < lattice[c].size(); n++)
+                lattice[c][n] = random.UniformFloat(-1.0, 1.0);
+        }
+        std::vector<float> psi(size*size*size*3);
+        for (unsigned int k = 0; k < size; k++)
+            for (unsigned int j = 0; j < size; j++)
+                for (unsigned int i = 0; i < size; i++)
+                    for (unsigned int c = 0; c < 3; c++)
+                        psi[((k*size + j)*size + i)*3 + c] =
+                            Noise(lattice[c], period, i*scale, j*scale, k*scale);
+
+        // curl by central differences, wrapping at the borders
+        nx = ny = nz = size;
+        field.assign(size*size*size*4, 0.0);
+        const int s = size;
+        #define PSI(i,j,k,c) psi[((Wrap(k,s)*s + Wrap(j,s))*s + Wrap(i,s))*3 + (c)]
+        for (int k = 0; k < s; k++)
+            for (int j = 0; j < s; j++)
+                for (int i = 0; i < s; i++) {
+                    float* v = &field[Index(i,j,k)];
+                    v[0] = (PSI(i,j+1,k,2) - PSI(i,j-1,k,2))
+                        -  (PSI(i,j,k+1,1) - PSI(i,j,k-1,1));
+                    v[1] = (PSI(i,j,k+1,0) - PSI(i,j,k-1,0))
+                        -  (PSI(i+1,j,k,2) - PSI(i-1,j,k,2));
+                    v[2] = (PSI(i+1,j,k,1) - PSI(i-1,j,k,1))
+                        -  (PSI(i,j+1,k,0) - PSI(i,j-1,k,0));
+                    for (int c = 0; c < 3; c++)
+                        v[c] *= 0.5 / scale;
+                }
+        #undef PSI
+    }
+
+    void SetOrigin(Vector<3,float> origin) { this->origin = origin; }
+    void SetScroll(Vector<3,float> scroll) { this->scroll = scroll; }
+    void SetStrength(float strength) { this->strength = strength; }
+
+    /**
+     * Advance the scrolling, once per tick.
+     */
+    void Update(float dt) {
+        offset = offset + scroll * dt;
+        if (dt > 0.0) tick = dt;
+    }
+
+    /**
+     * Trilinearly interpolated field value at a world position.
+     */
+    inline Vector<3,float> Sample(const Vector<3,float>& p) const {
+        if (field.empty()) return Vector<3,float>();
+        float u = (p[0] - origin[0] - offset[0]) * invCellSize;
+        float v = (p[1] - origin[1] - offset[1]) * invCellSize;
+        float w = (p[2] - origin[2] - offset[2]) * invCellSize;
+        int i = int(std::floor(u)), j = int(std::floor(v)), k = int(std::floor(w));
+        float fu = u-i, fv = v-j, fw = w-k;
+        int i0 = Wrap(i,nx), i1 = Wrap(i+1,nx);
+        int j0 = Wrap(j,ny), j1 = Wrap(j+1,ny);
+        int k0 = Wrap(k,nz), k1 = Wrap(k+1,nz);
+        const float* f = &field[0];
+#ifdef __SSE__
+        __m128 a = _mm_set1_ps(fu), b = _mm_set1_ps(fv), c = _mm_set1_ps(fw);
+        #define LERP(x,y,t) _mm_add_ps(x, _mm_mul_ps(t, _mm_sub_ps(y, x)))
+        __m128 c00 = LERP(_mm_loadu_ps(f+Index(i0,j0,k0)), _mm_loadu_ps(f+Index(i1,j0,k0)), a);
+        __m128 c10 = LERP(_mm_loadu_ps(f+Index(i0,j1,k0)), _mm_loadu_ps(f+Index(i1,j1,k0)), a);
+        __m128 c01 = LERP(_mm_loadu_ps(f+Index(i0,j0,k1)), _mm_loadu_ps(f+Index(i1,j0,k1)), a);
+        __m128 c11 = LERP(_mm_loadu_ps(f+Index(i0,j1,k1)), _mm_loadu_ps(f+Index(i1,j1,k1)), a);
+        __m128 r = LERP(LERP(c00, c10, b), LERP(c01, c11, b), c);
+        #undef LERP
+        float out[4];
+        _mm_storeu_ps(out, r);
+        return Vector<3,float>(out[0], out[1], out[2]);
+#else
+        Vector<3,float> r;
+        for (unsigned int n = 0; n < 3; n++) {
+            float c00 = f[Index(i0,j0,k0)+n]*(1-fu) + f[Index(i1,j0,k0)+n]*fu;
+            float c10 = f[Index(i0,j1,k0)+n]*(1-fu) + f[Index(i1,j1,k0)+n]*fu;
+            float c01 = f[Index(i0,j0,k1)+n]*(1-fu) + f[Index(i1,j0,k1)+n]*fu;
+            float c11 = f[Index(i0,j1,k1)+n]*(1-fu) + f[Index(i1,j1,k1)+n]*fu;
+            r[n] = (c00*(1-fv) + c10*fv)*(1-fw) + (c01*(1-fv) + c11*fv)*fw;
+        }
+        return r;
+#endif
+    }
+
+    inline void Process(float dt, T& particle) {
+        // in a sub-step of a Fused pipeline the motion is that of the
+        // shorter step, scale the push so the tick gets the same total
+        float push = (dt < tick) ? strength * dt * (dt / tick) : strength * dt;
+        particle.previousPosition = particle.previousPosition
+            - Sample(particle.position) * push;
+    }
+};
+
+#endif
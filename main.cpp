@@ -57,6 +57,11 @@
 
 #include <Utils/PropertyTree.h>
 // OEParticleSim utility files
+#include "AsyncTextureLoader.h"
+#include "FrameBudgetGovernor.h"
+#include "FireNode.h"
+#include "HeadlessEmitter.h"
+#include "ParticleStreamNode.h"
 
 // mouse tools
 // #include <Utils/MouseSelection.h>
@@ -89,24 +94,25 @@ namespace OpenEngine {
     namespace Utils {
         namespace Inspection {
 
-ValueList Inspect(SimpleEmitter* emit) {
+// count and interval go through the governable, which scales them
+ValueList Inspect(SimpleEmitter* emit, SimpleEmitterGovernable* gov) {
     // SimpleEmitter *emit = fire->GetEmitter();
     ValueList values;
 
     /* particle count */ {
-        RWValueCall<SimpleEmitter, unsigned int > *v
-            = new RWValueCall<SimpleEmitter, unsigned int >(*emit,
-                                                            &SimpleEmitter::GetNumParticles,
-                                                            &SimpleEmitter::SetNumParticles);
+        RWValueCall<SimpleEmitterGovernable, unsigned int > *v
+            = new RWValueCall<SimpleEmitterGovernable, unsigned int >(*gov,
+                                                            &SimpleEmitterGovernable::GetNumParticles,
+                                                            &SimpleEmitterGovernable::SetNumParticles);
         v->name = "count";
         v->properties[MIN] = 0.0;
         values.push_back(v);
     }
     /* emit interval */ {
-        RWValueCall<SimpleEmitter, float > *v
-            = new RWValueCall<SimpleEmitter, float >(*emit,
-                                                     &SimpleEmitter::GetEmitInterval,
-                                                     &SimpleEmitter::SetEmitInterval);
+        RWValueCall<SimpleEmitterGovernable, float > *v
+            = new RWValueCall<SimpleEmitterGovernable, float >(*gov,
+                                                     &SimpleEmitterGovernable::GetEmitInterval,
+                                                     &SimpleEmitterGovernable::SetEmitInterval);
         v->name = "emit interval";
         v->properties[MIN] = 0.0001;
         v->properties[STEP] = 0.0001;
@@ -260,9 +266,59 @@ ValueList Inspect(SimpleEmitter* emit) {
     
 }
 
+ValueList Inspect(FrameBudgetGovernor* gov) {
+    ValueList values;
+
+    /* budget */ {
+        RWValueCall<FrameBudgetGovernor, float > *v
+            = new RWValueCall<FrameBudgetGovernor, float >(*gov,
+                                                           &FrameBudgetGovernor::GetBudget,
+                                                           &FrameBudgetGovernor::SetBudget);
+        v->name = "budget (ms)";
+        v->properties[MIN] = 0.1;
+        v->properties[STEP] = 0.1;
+        values.push_back(v);
+    }
+    /* hysteresis */ {
+        RWValueCall<FrameBudgetGovernor, float > *v
+            = new RWValueCall<FrameBudgetGovernor, float >(*gov,
+                                                           &FrameBudgetGovernor::GetHysteresis,
+                                                           &FrameBudgetGovernor::SetHysteresis);
+        v->name = "hysteresis";
+        v->properties[MIN] = 0.0;
+        v->properties[MAX] = 1.0;
+        v->properties[STEP] = 0.01;
+        values.push_back(v);
+    }
+    /* cost */ {
+        RValueCall<FrameBudgetGovernor, float > *v
+            = new RValueCall<FrameBudgetGovernor, float >(*gov,
+                                                          &FrameBudgetGovernor::GetCost);
+        v->name = "cost (ms)";
+        values.push_back(v);
+    }
+    return values;
+}
+
 }}}
 
 
+// Sets the texture of an emitter or node when the AsyncTextureLoader
+// has uploaded it
+template <class T>
+class TextureHandler : public IListener<TextureLoadedEventArg> {
+private:
+    T& target;
+    string file;
+public:
+    TextureHandler(T& target, string file)
+        : target(target), file(file) {}
+    void Handle(TextureLoadedEventArg arg) {
+        if (arg.file == file)
+            target.SetTexture(arg.texture);
+    }
+};
+
 // Configuration structure to pass around to the setup methods
 struct Config {
     IEngine&              engine;
@@ -278,8 +334,16 @@ struct Config {
     ParticleSystem*       particleSystem;
     bool                  resourcesLoaded;
     TextureLoader*        tl;
+    AsyncTextureLoader*   atl;
     // MouseSelection*       ms;
     SimpleEmitter*           emitter;
+    bool                  useFire;
+    FireNode*             fire;
+    string                publish;
+    string                view;
+    FrameBudgetGovernor*  governor;
+    SimpleEmitterGovernable* emitterGovernable;
+    unsigned int          emitterBudget;
     Config(IEngine& engine)
         : engine(engine)
         , frame(NULL)
@@ -293,8 +357,14 @@ struct Config {
         , particleSystem(NULL)
         , resourcesLoaded(false)
         , tl(NULL)
+        , atl(NULL)
         // , ms(NULL)
         , emitter(NULL)
+        , useFire(false)
+        , fire(NULL)
+        , governor(NULL)
+        , emitterGovernable(NULL)
+        , emitterBudget(0)
     {}
 };
 
@@ -306,6 +376,7 @@ void SetupScene(Config&);
 void SetupRendering(Config&);
 void SetupDevices(Config&);
 void SetupDebugging(Config&);
+void SetupHeadless(Config&);
 
 int main(int argc, char** argv) {
     // Setup logging facilities.
@@ -334,6 +405,28 @@ int main(int argc, char** argv) {
     Engine* engine = new Engine();
     Config config(*engine);
 
+    // --fire adds the atlas textured fire node next to the emitter
+    // --publish <name> simulates without display into a particle stream
+    // --view <name> draws a particle stream published by another process
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--fire")
+            config.useFire = true;
+        else if (arg == "--publish" && i+1 < argc)
+            config.publish = argv[++i];
+        else if (arg == "--view" && i+1 < argc)
+            config.view = argv[++i];
+    }
+
+    if (config.publish != "") {
+        SetupResources(config);
+        SetupParticleSystem(config);
+        SetupHeadless(config);
+        engine->Start();
+        delete engine;
+        return EXIT_SUCCESS;
+    }
+
     // Setup the engine
     SetupResources(config);
     SetupDisplay(config);
@@ -360,7 +453,7 @@ void SetupResources(Config& config) {
     DirectoryManager::AppendPath("projects/OEParticleSim/");
 
     // load resource plug-ins
-    //ResourceManager<IModelResource>::AddPlugin(new OBJPlugin());
+    ResourceManager<IModelResource>::AddPlugin(new OBJPlugin());
     //    ResourceManager<ITextureResource>::AddPlugin(new TGAPlugin());
     ResourceManager<ITextureResource>::AddPlugin(new SDLImagePlugin());
     // ResourceManager<IFontResource>::AddPlugin(new SDLFontPlugin());
@@ -403,11 +496,17 @@ void SetupRendering(Config& config) {
     config.tl = new TextureLoader(*config.renderer);
     config.renderer->PreProcessEvent().Attach(*config.tl);
 
+    // Decode textures in the background, upload on the render thread
+    config.atl = new AsyncTextureLoader(*config.tl);
+    config.renderer->PreProcessEvent().Attach(*config.atl);
+    config.engine.DeinitializeEvent().Attach(*config.atl);
+
 
     // config.ms = new MouseSelection(*config.frame, *config.mouse, NULL);
 
     string confPath = DirectoryManager::FindFileInPath("emitter.yaml");
     PropertyTree* ptree = new PropertyTree(confPath);
+    config.atl->Prefetch(ptree->GetRootNode());
     //config.engine.InitializeEvent().Attach(*ptree);
     config.engine.ProcessEvent().Attach(*ptree);
     //config.engine.DeinitializeEvent().Attach(*ptree);
@@ -420,13 +519,20 @@ void SetupRendering(Config& config) {
     //                                    0.0,0.0,
     //                                    20.0, 0.0,
     //                                    10.0,0.0);
-    config.particleSystem->ProcessEvent().Attach(*config.emitter);
-    ITexture2DPtr tex1 = 
-        // ResourceManager<ITexture2D>::Create("Smoke/smoke01.tga");
-        // ResourceManager<ITexture2D>::Create("fire.jpg");
-        //ResourceManager<ITexture2D>::Create("RealFlame_02.png");
-        ResourceManager<ITexture2D>::Create("star.jpg");
-    config.emitter->SetTexture(tex1);
+    config.emitterGovernable = new SimpleEmitterGovernable(*config.emitter);
+    config.emitterBudget = 
+        config.governor->AddEffect("emitter", config.emitterGovernable);
+    config.particleSystem->ProcessEvent()
+        .Attach(*config.governor->TimeUpdate<ParticleEventArg>(config.emitterBudget, *config.emitter));
+    // the emitter gets its texture once it is uploaded
+    string tex1 = 
+        // "Smoke/smoke01.tga";
+        // "fire.jpg";
+        //"RealFlame_02.png";
+        "star.jpg";
+    config.atl->LoadedEvent()
+        .Attach(*(new TextureHandler<SimpleEmitter>(*config.emitter, tex1)));
+    config.atl->Load(tex1);
 
     // SelectionSet<ISceneNode>* ss = new SelectionSet<ISceneNode>();
     // TransformationTool* tt = new TransformationTool(*config.tl);
@@ -488,6 +594,10 @@ void SetupParticleSystem (Config& config) {
     config.engine.InitializeEvent().Attach(*config.particleSystem);
     config.engine.ProcessEvent().Attach(*pstimer);
     config.engine.DeinitializeEvent().Attach(*config.particleSystem);
+
+    // Keep the particle effects within their frame time budget
+    config.governor = new FrameBudgetGovernor();
+    config.engine.ProcessEvent().Attach(*config.governor);
 }
 
 void SetupScene(Config& config) {
@@ -510,12 +620,31 @@ void SetupScene(Config& config) {
 
 
 
-    // add a post process particle renderer
+    // add a post process particle renderer, it draws all simple
+    // emitters and is charged to the only one there is
     ParticleRenderer<SimpleEmitter::TYPE>* pr = new ParticleRenderer<SimpleEmitter::TYPE>();
-    config.renderer->PostProcessEvent().Attach(*pr);
+    config.renderer->PostProcessEvent()
+        .Attach(*config.governor->TimeRender<RenderingEventArg>(config.emitterBudget, *pr));
     config.scene->AddNode( config.emitter );
     config.emitter->SetActive(true);
 
+    if (config.useFire) {
+        config.fire = new FireNode(config.particleSystem, *config.tl);
+        unsigned int fireBudget = config.governor->AddEffect("fire", config.fire);
+        config.particleSystem->ProcessEvent()
+            .Attach(*config.governor->TimeUpdate<ParticleEventArg>(fireBudget, *config.fire));
+        config.scene->AddNode(config.governor->TimeRender(fireBudget, *config.fire));
+    }
+
+    if (config.view != "") {
+        ParticleStreamNode* stream = new ParticleStreamNode(config.view);
+        string tex = "Smoke/smoke03.tga";
+        config.atl->LoadedEvent()
+            .Attach(*(new TextureHandler<ParticleStreamNode>(*stream, tex)));
+        config.atl->Load(tex);
+        config.scene->AddNode(stream);
+    }
+
     BetterMoveHandler* move_h = new BetterMoveHandler(*config.camera, *config.mouse, true);
 
     config.keyboard->KeyEvent().Attach(*atb);
@@ -531,11 +660,15 @@ void SetupScene(Config& config) {
     atb->MouseButtonEvent().Attach(*move_h);
     atb->MouseMovedEvent().Attach(*move_h);
 
-    ITweakBar *bar = new InspectionBar("emitter",OpenEngine::Utils::Inspection::Inspect(config.emitter));     
+    ITweakBar *bar = new InspectionBar("emitter",OpenEngine::Utils::Inspection::Inspect(config.emitter, config.emitterGovernable));     
     atb->AddBar(bar);
     bar->SetPosition(Vector<2,float>(20,40));
     bar->SetIconify(false);
 
+    ITweakBar *govbar = new InspectionBar("particle budget",OpenEngine::Utils::Inspection::Inspect(config.governor));
+    atb->AddBar(govbar);
+    govbar->SetPosition(Vector<2,float>(20,400));
+
 
     // Setup fps counter
     FPSSurfacePtr fps = FPSSurface::Create();
@@ -549,6 +682,17 @@ void SetupScene(Config& config) {
 
 }
 
+void SetupHeadless(Config& config) {
+    if (config.particleSystem == NULL)
+        throw Exception("Setup headless dependencies are not satisfied.");
+
+    // the particle system runs on the engine loop without any display,
+    // every tick is published for viewers in other processes
+    HeadlessEmitter* emitter = new HeadlessEmitter(config.publish, 2000, 0.5);
+    config.particleSystem->ProcessEvent().Attach(*emitter);
+    logger.info << "Publishing particles to stream " << config.publish << logger.end;
+}
+
 void SetupDebugging(Config& config) {
 
     // Visualization of the frustum